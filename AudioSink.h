@@ -0,0 +1,41 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+#include <chrono>
+template <class Sink> class AudioOutput {
+    Sink& m_sink; double m_fill, m_ratio; std::chrono::steady_clock::time_point m_last; int16_t m_scratch[2048];
+public:
+    static constexpr double TARGET_MS = 30, MAX_QUEUE_MS = 120, MAX_RATE_DELTA = 0.005, SMOOTHING_SECONDS = 0.25;
+    explicit AudioOutput(Sink& sink) : m_sink(sink) { Reset(); }
+    void Reset() { m_fill = TARGET_MS; m_ratio = 1.0; m_last = std::chrono::steady_clock::now(); }
+    double QueuedMs(const AudioRing& ring) { return (m_sink.Queued() + ring.Size() / 2) * 1000.0 / SAMPLE_RATE; }
+    double Ratio() const { return m_ratio; }
+    double Pump(AudioRing& ring) {
+        const size_t maxQueued = (size_t)(MAX_QUEUE_MS * SAMPLE_RATE / 1000); size_t queued = m_sink.Queued();
+        if (queued + ring.Size() / 2 > maxQueued) ring.Discard((queued + ring.Size() / 2 - maxQueued) * 2);
+        if (!queued && !ring.Empty()) { const size_t target = (size_t)(TARGET_MS * SAMPLE_RATE / 1000); memset(m_scratch, 0, sizeof(m_scratch)); for (size_t pad = ring.Size() / 2; pad < target;) pad += m_sink.Write(m_scratch, (std::min)(target - pad, sizeof(m_scratch) / sizeof(int16_t) / 2)); }
+        for (size_t n; (n = ring.Read(m_scratch, sizeof(m_scratch) / sizeof(int16_t))) > 0;) m_sink.Write(m_scratch, n / 2);
+        auto now = std::chrono::steady_clock::now(); double dt = std::chrono::duration<double>(now - m_last).count(); m_last = now;
+        m_fill += (m_sink.Queued() * 1000.0 / SAMPLE_RATE - m_fill) * (std::min)(dt / SMOOTHING_SECONDS, 1.0);
+        m_ratio = 1.0 + MAX_RATE_DELTA * (std::max)(-1.0, (std::min)(1.0, (TARGET_MS - m_fill) / TARGET_MS)); return m_ratio;
+    }
+};
+class FileAudioSink {
+    FILE* m_file; double m_clockScale; uint64_t m_written, m_baseFrames, m_underruns; std::chrono::steady_clock::time_point m_base; bool m_started, m_paused, m_starved;
+    uint64_t Played() {
+        if (!m_started || m_paused) return m_baseFrames; auto now = std::chrono::steady_clock::now();
+        uint64_t played = m_baseFrames + (uint64_t)(std::chrono::duration<double>(now - m_base).count() * SAMPLE_RATE * m_clockScale);
+        if (played <= m_written) return played; if (!m_starved) m_underruns++; m_starved = true; m_baseFrames = m_written; m_base = now; return m_written;
+    }
+public:
+    explicit FileAudioSink(const std::wstring& path = std::wstring(), double clockScale = 1.0) : m_file(path.empty() ? NULL : OpenFile(path, L"wb")), m_clockScale(clockScale), m_written(0), m_baseFrames(0), m_underruns(0), m_started(false), m_paused(false), m_starved(false) {}
+    ~FileAudioSink() { if (m_file) fclose(m_file); }
+    FileAudioSink(const FileAudioSink&) = delete; FileAudioSink& operator=(const FileAudioSink&) = delete;
+    size_t Queued() { return (size_t)(m_written - Played()); }
+    size_t Write(const int16_t* samples, size_t frames) {
+        if (!frames) return 0; Played(); if (m_file) fwrite(samples, sizeof(int16_t) * 2, frames, m_file); m_written += frames; m_starved = false;
+        if (!m_started) { m_started = true; m_base = std::chrono::steady_clock::now(); } return frames;
+    }
+    void Pause() { m_baseFrames = Played(); m_paused = true; }
+    void Resume() { if (!m_paused) return; m_paused = false; m_baseFrames = m_written; m_base = std::chrono::steady_clock::now(); }
+    uint64_t Underruns() const { return m_underruns; }
+};
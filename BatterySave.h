@@ -0,0 +1,28 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+class BatterySaver {
+    std::wstring m_path, m_writingPath; std::vector<Byte> m_image, m_writing; bool m_pending, m_busy, m_stop;
+    std::mutex m_lock; std::condition_variable m_workCv, m_idleCv; std::thread m_thread;
+    void WorkerLoop() {
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (true) {
+            m_workCv.wait(guard, [&] { return m_stop || m_pending; }); if (!m_pending) break;
+            m_writingPath = m_path; m_writing.assign(m_image.begin(), m_image.end()); m_pending = false; m_busy = true;
+            guard.unlock(); WriteFileAtomic(m_writingPath, m_writing.data(), m_writing.size()); guard.lock();
+            m_busy = false; if (!m_pending) m_idleCv.notify_all();
+        }
+    }
+public:
+    static constexpr int FLUSH_INTERVAL_FRAMES = 60;
+    BatterySaver() : m_pending(false), m_busy(false), m_stop(false) { m_thread = std::thread(&BatterySaver::WorkerLoop, this); }
+    ~BatterySaver() { { std::lock_guard<std::mutex> guard(m_lock); m_stop = true; } m_workCv.notify_all(); m_thread.join(); }
+    void Capture(GameBoyCore& core, bool full = false) {
+        std::unique_lock<std::mutex> guard(m_lock);
+        if (core.m_savePath != m_path) { m_idleCv.wait(guard, [&] { return !m_pending && !m_busy; }); m_path = core.m_savePath; m_image.clear(); }
+        if (core.CaptureSave(m_image, full || m_image.empty())) { m_pending = true; m_workCv.notify_one(); }
+    }
+    void Flush() { std::unique_lock<std::mutex> guard(m_lock); m_idleCv.wait(guard, [&] { return !m_pending && !m_busy; }); }
+};
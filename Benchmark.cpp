@@ -0,0 +1,54 @@
+﻿// g++ -O2 -std=c++17 Benchmark.cpp -o gbbench   (add -DGB_PROFILE for the per-subsystem breakdown)
+#include "GameBoyCore.h"
+#include "SyntheticRoms.h"
+#include <chrono>
+#include <memory>
+struct BenchOptions { int frames = 3000, warmup = 120, repeats = 3; std::string output; };
+struct BenchCase { const char* name; std::vector<Byte> (*build)(); };
+struct BenchResult { std::string name; double seconds; uint64_t profileNs[Scheduler::PROF_COUNT]; uint32_t checksum; };
+static bool ParseArgs(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i]; bool hasValue = (i + 1 < argc);
+        if (arg == "-f" && hasValue) opt.frames = atoi(argv[++i]); else if (arg == "-w" && hasValue) opt.warmup = atoi(argv[++i]);
+        else if (arg == "-r" && hasValue) opt.repeats = atoi(argv[++i]); else if (arg == "-o" && hasValue) opt.output = argv[++i]; else return false;
+    }
+    return opt.frames > 0 && opt.warmup >= 0 && opt.repeats > 0;
+}
+static BenchResult RunCase(const BenchCase& c, const BenchOptions& opt) {
+    BenchResult best = { c.name, 0, {}, 0 };
+    for (int r = 0; r < opt.repeats; r++) {
+        std::unique_ptr<GameBoyCore> core(new GameBoyCore()); if (c.build) core->LoadRomImage(c.build());
+        for (int f = 0; f < opt.warmup; f++) { core->StepFrame(); core->GetAudioSamples().Clear(); }
+        core->sched.ClearProfile(); auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < opt.frames; f++) { core->StepFrame(); core->GetAudioSamples().Clear(); }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (r == 0 || seconds < best.seconds) {
+            best.seconds = seconds; memcpy(best.profileNs, core->sched.profileNs, sizeof(best.profileNs));
+            best.checksum = 0; for (uint32_t px : core->displayBuffer) best.checksum = best.checksum * 31 + px;
+        }
+    }
+    return best;
+}
+int main(int argc, char** argv) {
+    BenchOptions opt; if (!ParseArgs(argc, argv, opt)) { fprintf(stderr, "usage: %s [-f frames] [-w warmup-frames] [-r repeats] [-o results.json]\n", argv[0]); return 1; }
+    const BenchCase cases[] = { { "test_pattern", nullptr }, { "cpu_stress", BuildCpuStressRom }, { "ppu_stress", BuildPpuStressRom }, { "apu_stress", BuildApuStressRom } };
+#ifdef GB_PROFILE
+    const bool profiled = true;
+#else
+    const bool profiled = false;
+#endif
+    std::string json = "{\n  \"frames\": " + std::to_string(opt.frames) + ",\n  \"repeats\": " + std::to_string(opt.repeats) + ",\n  \"profiled\": " + (profiled ? "true" : "false") + ",\n  \"results\": [\n";
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        BenchResult r = RunCase(cases[i], opt); double nsPerFrame = r.seconds * 1e9 / opt.frames; char line[512];
+        snprintf(line, sizeof(line), "    { \"name\": \"%s\", \"fps\": %.1f, \"ns_per_frame\": %.0f, \"realtime\": %.2f, \"checksum\": \"%08x\"", r.name.c_str(), opt.frames / r.seconds, nsPerFrame, opt.frames / r.seconds / 59.7275, r.checksum); json += line;
+        if (profiled) {
+            const uint64_t* p = r.profileNs; double perFrame = 1.0 / opt.frames; uint64_t cpu = p[Scheduler::PROF_FRAME] - (std::min)(p[Scheduler::PROF_FRAME], p[Scheduler::PROF_PPU] + p[Scheduler::PROF_APU] + p[Scheduler::PROF_TIMERS]);
+            snprintf(line, sizeof(line), ", \"breakdown_ns_per_frame\": { \"cpu\": %.0f, \"ppu\": %.0f, \"apu\": %.0f, \"timers\": %.0f }", cpu * perFrame, p[Scheduler::PROF_PPU] * perFrame, p[Scheduler::PROF_APU] * perFrame, p[Scheduler::PROF_TIMERS] * perFrame); json += line;
+        }
+        json += (i + 1 < sizeof(cases) / sizeof(cases[0])) ? " },\n" : " }\n";
+    }
+    json += "  ]\n}\n";
+    if (opt.output.empty()) fputs(json.c_str(), stdout);
+    else { FILE* fp = fopen(opt.output.c_str(), "w"); if (!fp) { fprintf(stderr, "failed to open %s\n", opt.output.c_str()); return 1; } fputs(json.c_str(), fp); fclose(fp); }
+    return 0;
+}
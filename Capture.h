@@ -0,0 +1,90 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+class CaptureWriter {
+    static constexpr int POOL_FRAMES = 6;
+    FILE* m_video; FILE* m_audio; AudioRing* m_ring; int m_scale; bool m_y4m, m_stop; uint64_t m_audioBytes, m_frames;
+    std::vector<std::vector<uint32_t>> m_free; std::deque<std::vector<uint32_t>> m_queue; std::vector<uint32_t> m_scaledPixels; std::vector<Byte> m_planes, m_scaled; std::vector<int16_t> m_samples;
+    std::mutex m_lock; std::condition_variable m_workCv, m_freeCv; std::thread m_thread;
+    static void ScaleRow(uint32_t* dst, const uint32_t* src, int width, int k) {
+        int x = 0;
+#ifdef GB_SSE2
+        if (k == 2) { for (; x + 4 <= width; x += 4) { __m128i v = _mm_loadu_si128((const __m128i*)(src + x)); _mm_storeu_si128((__m128i*)(dst + x * 2), _mm_unpacklo_epi32(v, v)); _mm_storeu_si128((__m128i*)(dst + x * 2 + 4), _mm_unpackhi_epi32(v, v)); } }
+        else if (k % 4 == 0) { for (; x < width; x++) { __m128i v = _mm_set1_epi32((int)src[x]); for (int j = 0; j < k; j += 4) _mm_storeu_si128((__m128i*)(dst + x * k + j), v); } }
+#endif
+        for (; x < width; x++) for (int j = 0; j < k; j++) dst[x * k + j] = src[x];
+    }
+    static void ScaleRow(Byte* dst, const Byte* src, int width, int k) {
+        int x = 0;
+#ifdef GB_SSE2
+        if (k == 2 || k == 4) {
+            for (; x + 16 <= width; x += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(src + x)), lo = _mm_unpacklo_epi8(v, v), hi = _mm_unpackhi_epi8(v, v);
+                if (k == 2) { _mm_storeu_si128((__m128i*)(dst + x * 2), lo); _mm_storeu_si128((__m128i*)(dst + x * 2 + 16), hi); continue; }
+                _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_unpacklo_epi16(lo, lo)); _mm_storeu_si128((__m128i*)(dst + x * 4 + 16), _mm_unpackhi_epi16(lo, lo));
+                _mm_storeu_si128((__m128i*)(dst + x * 4 + 32), _mm_unpacklo_epi16(hi, hi)); _mm_storeu_si128((__m128i*)(dst + x * 4 + 48), _mm_unpackhi_epi16(hi, hi));
+            }
+        }
+#endif
+        for (; x < width; x++) for (int j = 0; j < k; j++) dst[x * k + j] = src[x];
+    }
+    void WriteVideo(const std::vector<uint32_t>& pixels) {
+        const size_t width = GB_WIDTH * m_scale;
+        if (!m_y4m) {
+            if (m_scale == 1) { fwrite(pixels.data(), sizeof(uint32_t), pixels.size(), m_video); return; }
+            for (int y = 0; y < GB_HEIGHT; y++) { uint32_t* row = &m_scaledPixels[y * m_scale * width]; ScaleRow(row, &pixels[y * GB_WIDTH], GB_WIDTH, m_scale); for (int j = 1; j < m_scale; j++) memcpy(row + j * width, row, width * sizeof(uint32_t)); }
+            fwrite(m_scaledPixels.data(), sizeof(uint32_t), m_scaledPixels.size(), m_video); return;
+        }
+        const int plane = GB_WIDTH * GB_HEIGHT; uint32_t lastColor = ~pixels[0]; Byte yuv[3] = {};
+        for (int i = 0; i < plane; i++) {
+            uint32_t c = pixels[i];
+            if (c != lastColor) { int r = (c >> 16) & 0xFF, g = (c >> 8) & 0xFF, b = c & 0xFF; lastColor = c; yuv[0] = (Byte)((77 * r + 150 * g + 29 * b + 128) >> 8); yuv[1] = (Byte)((-43 * r - 85 * g + 128 * b + 32768 + 128) >> 8); yuv[2] = (Byte)((128 * r - 107 * g - 21 * b + 32768 + 128) >> 8); }
+            m_planes[i] = yuv[0]; m_planes[plane + i] = yuv[1]; m_planes[plane * 2 + i] = yuv[2];
+        }
+        fwrite("FRAME\n", 1, 6, m_video);
+        if (m_scale == 1) { fwrite(m_planes.data(), 1, m_planes.size(), m_video); return; }
+        for (int p = 0; p < 3; p++) for (int y = 0; y < GB_HEIGHT; y++) { Byte* row = &m_scaled[(p * GB_HEIGHT + y) * m_scale * width]; ScaleRow(row, &m_planes[p * plane + y * GB_WIDTH], GB_WIDTH, m_scale); for (int j = 1; j < m_scale; j++) memcpy(row + j * width, row, width); }
+        fwrite(m_scaled.data(), 1, m_scaled.size(), m_video);
+    }
+    void DrainAudio() { if (!m_audio || !m_ring) return; for (size_t n; (n = m_ring->Read(m_samples.data(), m_samples.size())) > 0;) { fwrite(m_samples.data(), sizeof(int16_t), n, m_audio); m_audioBytes += n * sizeof(int16_t); } }
+    void WriteWavHeader() {
+        uint32_t dataBytes = (uint32_t)m_audioBytes, riffBytes = dataBytes + 36, fmtBytes = 16, rate = SAMPLE_RATE, byteRate = SAMPLE_RATE * 4; uint16_t format = 1, channels = 2, align = 4, bits = 16;
+        fseek(m_audio, 0, SEEK_SET); fwrite("RIFF", 1, 4, m_audio); fwrite(&riffBytes, 4, 1, m_audio); fwrite("WAVEfmt ", 1, 8, m_audio); fwrite(&fmtBytes, 4, 1, m_audio);
+        fwrite(&format, 2, 1, m_audio); fwrite(&channels, 2, 1, m_audio); fwrite(&rate, 4, 1, m_audio); fwrite(&byteRate, 4, 1, m_audio); fwrite(&align, 2, 1, m_audio); fwrite(&bits, 2, 1, m_audio);
+        fwrite("data", 1, 4, m_audio); fwrite(&dataBytes, 4, 1, m_audio); fseek(m_audio, 0, SEEK_END);
+    }
+    void WorkerLoop() {
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (true) {
+            m_workCv.wait(guard, [&] { return m_stop || !m_queue.empty(); }); if (m_queue.empty()) break;
+            std::vector<uint32_t> pixels = std::move(m_queue.front()); m_queue.pop_front(); guard.unlock();
+            if (m_video) WriteVideo(pixels); DrainAudio(); guard.lock(); m_frames++; m_free.push_back(std::move(pixels)); m_freeCv.notify_one();
+        }
+    }
+public:
+    CaptureWriter() : m_video(NULL), m_audio(NULL), m_ring(nullptr), m_scale(1), m_y4m(false), m_stop(false), m_audioBytes(0), m_frames(0) {}
+    ~CaptureWriter() { Close(); }
+    CaptureWriter(const CaptureWriter&) = delete; CaptureWriter& operator=(const CaptureWriter&) = delete;
+    bool Open(GameBoyCore& core, const std::wstring& videoPath, const std::wstring& wavPath, int scale = 1) {
+        Close(); m_scale = (std::max)(scale, 1); m_y4m = videoPath.size() >= 4 && videoPath.compare(videoPath.size() - 4, 4, L".y4m") == 0; m_stop = false; m_audioBytes = m_frames = 0;
+        if (!videoPath.empty() && !(m_video = OpenFile(videoPath, L"wb"))) return false; if (!wavPath.empty() && !(m_audio = OpenFile(wavPath, L"wb"))) { Close(); return false; }
+        if (m_y4m) fprintf(m_video, "YUV4MPEG2 W%d H%d F4194304:70224 Ip A1:1 C444\n", GB_WIDTH * m_scale, GB_HEIGHT * m_scale);
+        if (m_audio) WriteWavHeader(); m_ring = &core.GetAudioSamples(); m_ring->Clear();
+        const size_t scaled = (size_t)GB_WIDTH * GB_HEIGHT * m_scale * m_scale; m_scaledPixels.resize(m_y4m || m_scale == 1 ? 0 : scaled); m_planes.resize(GB_WIDTH * GB_HEIGHT * 3); m_scaled.resize(m_y4m && m_scale > 1 ? scaled * 3 : 0); m_samples.resize(4096);
+        m_free.assign(POOL_FRAMES, std::vector<uint32_t>(GB_WIDTH * GB_HEIGHT)); m_thread = std::thread(&CaptureWriter::WorkerLoop, this); return true;
+    }
+    bool Active() const { return m_thread.joinable(); }
+    size_t VideoFrameBytes() const { return (size_t)GB_WIDTH * GB_HEIGHT * m_scale * m_scale * (m_y4m ? 3 : 4) + (m_y4m ? 6 : 0); }
+    uint64_t FramesWritten() { std::lock_guard<std::mutex> guard(m_lock); return m_frames; }
+    void SubmitFrame(GameBoyCore& core) {
+        if (!Active()) return; std::unique_lock<std::mutex> guard(m_lock); m_freeCv.wait(guard, [&] { return !m_free.empty(); });
+        std::vector<uint32_t> pixels = std::move(m_free.back()); m_free.pop_back(); core.SwapDisplayBuffer(pixels); m_queue.push_back(std::move(pixels)); m_workCv.notify_one();
+    }
+    void Close() {
+        if (m_thread.joinable()) { { std::lock_guard<std::mutex> guard(m_lock); m_stop = true; } m_workCv.notify_all(); m_thread.join(); }
+        if (m_audio) { DrainAudio(); WriteWavHeader(); fclose(m_audio); m_audio = NULL; } if (m_video) { fclose(m_video); m_video = NULL; } m_ring = nullptr;
+    }
+};
@@ -0,0 +1,69 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "BatterySave.h"
+#include <mutex>
+#include <thread>
+#include <chrono>
+class CoreRunner {
+public:
+    struct Frame { std::vector<uint32_t> pixels; uint64_t number, publishedNs; };
+    static constexpr double FRAME_SECONDS = 70224.0 / 4194304.0; static constexpr int FAST_FORWARD_SPEED = 8, MAX_RUN_AHEAD = 4;
+    static uint64_t NowNs() { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+private:
+    static constexpr unsigned FRESH = 4; static constexpr int MAX_LAG_FRAMES = 3;
+    GameBoyCore& m_core; RewindBuffer* m_rewind; BatterySaver* m_saver; MovieWriter m_movie; std::vector<Byte> m_snapshot; int m_framesSinceSave; Frame m_frames[3]; int m_back, m_front; std::atomic<unsigned> m_middle;
+    RingBuffer<Byte, 256> m_keys; std::atomic<bool> m_stop, m_paused, m_rewinding; std::atomic<int> m_speed, m_runAhead; std::atomic<double> m_audioRate; std::atomic<uint64_t> m_framesRun; std::mutex m_coreLock; std::thread m_thread;
+    void Publish() {
+        Frame& f = m_frames[m_back]; memcpy(f.pixels.data(), m_core.GetPixelData(), f.pixels.size() * sizeof(uint32_t)); f.number = m_framesRun; f.publishedNs = NowNs();
+        m_back = (int)(m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & 3);
+    }
+    void RunFrame() {
+        std::lock_guard<std::mutex> guard(m_coreLock); Byte key;
+        while (m_keys.Read(&key, 1)) { m_core.InputKey(key & 0x7F, (key & 0x80) != 0); m_movie.InputKey(key & 0x7F, (key & 0x80) != 0); }
+        m_core.SetAudioRate(m_movie.Recording() ? 1.0 : m_audioRate.load(std::memory_order_relaxed));
+        if (m_rewinding && m_rewind) { EndRecording(); m_rewind->Rewind(m_core); m_framesRun++; Publish(); return; }
+        for (int i = 1; i < m_speed; i++) StepCore(false);
+        int ahead = m_movie.Recording() ? 0 : m_runAhead.load(std::memory_order_relaxed);
+        if (ahead) RunAhead(ahead); else StepCore(true); if (m_rewind) m_rewind->Push(m_core); if (!ahead) Publish();
+        if (m_saver && ++m_framesSinceSave >= BatterySaver::FLUSH_INTERVAL_FRAMES) { m_framesSinceSave = 0; if (m_core.mmu.SramDirty()) m_saver->Capture(m_core); }
+    }
+    void StepCore(bool produceOutput) { m_core.StepFrame(produceOutput); m_movie.EndFrame(m_core, produceOutput); m_framesRun++; }
+    void RunAhead(int frames) {
+        m_core.StepFrame(frames == 1, true); m_framesRun++; m_core.SaveSnapshot(m_snapshot);
+        for (int i = 1; i <= frames; i++) m_core.StepFrame(i >= frames - 1, false); Publish(); m_core.RestoreSnapshot(m_snapshot);
+    }
+    bool EndRecording() { if (!m_movie.Recording()) return false; m_movie.Finish(); m_core.SetEmulatedClock(false); return true; }
+    void ThreadLoop() {
+        const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(FRAME_SECONDS)); auto deadline = std::chrono::steady_clock::now();
+        while (!m_stop) {
+            if (m_paused) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); deadline = std::chrono::steady_clock::now(); continue; }
+            RunFrame(); deadline += period; auto now = std::chrono::steady_clock::now();
+            if (now - deadline > period * MAX_LAG_FRAMES) deadline = now; else std::this_thread::sleep_until(deadline);
+        }
+    }
+public:
+    explicit CoreRunner(GameBoyCore& core, RewindBuffer* rewind = nullptr, BatterySaver* saver = nullptr) : m_core(core), m_rewind(rewind), m_saver(saver), m_framesSinceSave(0), m_back(0), m_front(1), m_middle(2), m_stop(true), m_paused(false), m_rewinding(false), m_speed(1), m_runAhead(0), m_audioRate(1.0), m_framesRun(0) {
+        for (Frame& f : m_frames) { f.pixels.assign(GB_WIDTH * GB_HEIGHT, 0); f.number = 0; f.publishedNs = 0; }
+    }
+    ~CoreRunner() { Stop(); }
+    void Start() { if (m_thread.joinable()) return; m_stop = false; m_thread = std::thread(&CoreRunner::ThreadLoop, this); }
+    void Stop() { m_stop = true; if (m_thread.joinable()) m_thread.join(); }
+    void RunFrames(int count) { for (int i = 0; i < count; i++) RunFrame(); }
+    void SetPaused(bool paused) { m_paused = paused; } void SetRewinding(bool rewinding) { m_rewinding = rewinding; }
+    void SetFastForward(int speed) { m_speed = (std::max)(speed, 1); }
+    void SetRunAhead(int frames) { m_runAhead = (std::max)(0, (std::min)(frames, MAX_RUN_AHEAD)); } int RunAheadFrames() const { return m_runAhead; }
+    void SetAudioRate(double ratio) { m_audioRate.store(ratio, std::memory_order_relaxed); }
+    void InputKey(int key, bool pressed) { Byte event = (Byte)(key | (pressed ? 0x80 : 0)); m_keys.Write(&event, 1); }
+    uint64_t FramesRun() const { return m_framesRun; }
+    const Frame* AcquireFrame() {
+        if (!(m_middle.load(std::memory_order_acquire) & FRESH)) return nullptr;
+        m_front = (int)(m_middle.exchange(m_front, std::memory_order_acq_rel) & 3); return &m_frames[m_front];
+    }
+    const Frame& CurrentFrame() const { return m_frames[m_front]; }
+    AudioRing& Audio() { return m_core.GetAudioSamples(); }
+    bool StartRecording(const std::wstring& path) { std::lock_guard<std::mutex> guard(m_coreLock); if (m_movie.Begin(m_core, path)) return true; m_core.SetEmulatedClock(false); return false; }
+    bool StopRecording() { std::lock_guard<std::mutex> guard(m_coreLock); return EndRecording(); }
+    template <class F> void WithCore(F fn) { std::lock_guard<std::mutex> guard(m_coreLock); fn(m_core); }
+};
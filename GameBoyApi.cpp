@@ -0,0 +1,47 @@
+﻿// g++ -O2 -std=c++17 -pthread -shared -fPIC GameBoyApi.cpp -o libgameboy.so   (MSVC: cl /O2 /std:c++17 /LD GameBoyApi.cpp /Fe:gameboy.dll)
+#define GAMEBOY_API_EXPORTS
+#include "GameBoyApi.h"
+#include "GameBoyCore.h"
+#include "WorkStealingPool.h"
+static_assert(GB_SCREEN_WIDTH == GB_WIDTH && GB_SCREEN_HEIGHT == GB_HEIGHT, "screen size mismatch");
+struct gb_pool {
+    std::shared_ptr<const RomImage> image; std::vector<std::unique_ptr<GameBoyCore>> cores; std::vector<Byte> held; WorkStealingPool workers;
+    std::atomic<int> next; const uint8_t* actions; int frames; uint32_t* argb; Byte* shades;
+    gb_pool(std::shared_ptr<const RomImage> rom, int envs, int threads) : image(std::move(rom)), cores(envs), held(envs, 0), workers((std::min)(threads > 0 ? threads : (int)std::thread::hardware_concurrency(), envs)), next(0), actions(nullptr), frames(0), argb(nullptr), shades(nullptr) {
+        for (auto& core : cores) { core.reset(new GameBoyCore()); core->LoadRomImage(image); }
+    }
+    void StepEnv(int env) {
+        GameBoyCore& core = *cores[env];
+        if (actions) { Byte changed = actions[env] ^ held[env]; for (int key = 0; key < 8; key++) if (changed & (1 << key)) core.InputKey(key, (actions[env] >> key) & 1); held[env] = actions[env]; }
+        core.SetFrameTargets(argb ? argb + (size_t)env * GB_SCREEN_PIXELS : nullptr, shades ? shades + (size_t)env * GB_SCREEN_PIXELS : nullptr);
+        for (int f = 0; f < frames; f++) core.StepFrame(f >= frames - 2, false);
+        core.SetFrameTargets(nullptr, nullptr);
+    }
+    void Step() { next = 0; for (int i = 0; i < workers.ThreadCount(); i++) workers.Submit([this] { for (int env; (env = next++) < (int)cores.size();) StepEnv(env); }); workers.Wait(); }
+};
+static std::wstring WidePath(const char* path) {
+#ifdef _WIN32
+    int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0); if (len <= 0) return std::wstring(); std::wstring w(len, L'\0'); MultiByteToWideChar(CP_UTF8, 0, path, -1, &w[0], len); w.resize(len - 1); return w;
+#else
+    std::wstring w(strlen(path) + 1, L'\0'); size_t len = mbstowcs(&w[0], path, w.size()); if (len == (size_t)-1) return std::wstring(path, path + strlen(path)); w.resize(len); return w;
+#endif
+}
+static gb_pool* CreatePool(std::shared_ptr<const RomImage> image, int envs, int threads) { if (!image || !image->size() || envs <= 0) return nullptr; try { return new gb_pool(std::move(image), envs, threads); } catch (...) { return nullptr; } }
+static GameBoyCore* Env(const gb_pool* pool, int env) { return pool && env >= 0 && env < (int)pool->cores.size() ? pool->cores[env].get() : nullptr; }
+extern "C" {
+GB_API gb_pool* gb_pool_create(const char* rom_path, int envs, int threads) { return rom_path ? CreatePool(RomImage::Open(WidePath(rom_path)), envs, threads) : nullptr; }
+GB_API gb_pool* gb_pool_create_from_memory(const uint8_t* rom, size_t size, int envs, int threads) { return rom ? CreatePool(RomImage::FromBytes(std::vector<Byte>(rom, rom + size)), envs, threads) : nullptr; }
+GB_API void gb_pool_destroy(gb_pool* pool) { delete pool; }
+GB_API int gb_pool_size(const gb_pool* pool) { return pool ? (int)pool->cores.size() : 0; }
+GB_API void gb_pool_reset(gb_pool* pool, int env) {
+    if (!pool) return; for (int i = 0; i < (int)pool->cores.size(); i++) if (env < 0 || i == env) { pool->cores[i]->LoadRomImage(pool->image); pool->held[i] = 0; }
+}
+GB_API int gb_pool_step(gb_pool* pool, const uint8_t* actions, int frames, uint32_t* argb_out, uint8_t* shade_out) {
+    if (!pool || frames <= 0) return -1; pool->actions = actions; pool->frames = frames; pool->argb = argb_out; pool->shades = shade_out; pool->Step(); return 0;
+}
+GB_API const uint8_t* gb_pool_wram(const gb_pool* pool, int env) { GameBoyCore* core = Env(pool, env); return core ? core->mmu.wram.data() : nullptr; }
+GB_API const uint8_t* gb_pool_hram(const gb_pool* pool, int env) { GameBoyCore* core = Env(pool, env); return core ? core->mmu.hram.data() : nullptr; }
+GB_API size_t gb_pool_state_size(gb_pool* pool) { return pool ? pool->cores[0]->SaveStateSize() : 0; }
+GB_API int gb_pool_save_state(gb_pool* pool, int env, void* buffer, size_t capacity) { GameBoyCore* core = Env(pool, env); return core && core->SaveState(buffer, capacity) ? 0 : -1; }
+GB_API int gb_pool_load_state(gb_pool* pool, int env, const void* buffer, size_t size) { GameBoyCore* core = Env(pool, env); return core && core->LoadState(buffer, size) ? 0 : -1; }
+}
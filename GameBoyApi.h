@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#if defined(_WIN32)
+#ifdef GAMEBOY_API_EXPORTS
+#define GB_API __declspec(dllexport)
+#else
+#define GB_API __declspec(dllimport)
+#endif
+#else
+#define GB_API __attribute__((visibility("default")))
+#endif
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* Frames are GB_SCREEN_WIDTH x GB_SCREEN_HEIGHT, row-major, one slot per environment laid out back to back. */
+enum { GB_SCREEN_WIDTH = 160, GB_SCREEN_HEIGHT = 144, GB_SCREEN_PIXELS = 160 * 144, GB_WRAM_SIZE = 0x2000, GB_HRAM_SIZE = 0x80 };
+/* Action bits: one byte per environment, a set bit holds the button down. */
+enum { GB_BUTTON_RIGHT = 1, GB_BUTTON_LEFT = 2, GB_BUTTON_UP = 4, GB_BUTTON_DOWN = 8, GB_BUTTON_A = 16, GB_BUTTON_B = 32, GB_BUTTON_SELECT = 64, GB_BUTTON_START = 128 };
+typedef struct gb_pool gb_pool;
+/* Creates envs cores sharing one ROM image; threads <= 0 uses every hardware thread. Returns NULL on failure. */
+GB_API gb_pool* gb_pool_create(const char* rom_path, int envs, int threads);
+GB_API gb_pool* gb_pool_create_from_memory(const uint8_t* rom, size_t size, int envs, int threads);
+GB_API void gb_pool_destroy(gb_pool* pool);
+GB_API int gb_pool_size(const gb_pool* pool);
+/* Power-cycles one environment, or all of them when env < 0. */
+GB_API void gb_pool_reset(gb_pool* pool, int env);
+/* Applies actions[env] (NULL keeps the held buttons), runs frames frames on every environment in parallel and renders the
+   last two of them straight into argb_out (envs * GB_SCREEN_PIXELS) and shade_out (same count, DMG shade 0-3, 0 = lightest).
+   Every pixel of both outputs is rewritten on each call: lines the LCD did not draw (LCD off for part or all of the frame)
+   come out as the LCD-off colour 0xFFE0F8D0 with shade 0, and with the background disabled (LCDC bit 0) only sprites
+   are drawn over that colour. Either output may be NULL. No audio is produced. Returns 0, or -1 on bad arguments. */
+GB_API int gb_pool_step(gb_pool* pool, const uint8_t* actions, int frames, uint32_t* argb_out, uint8_t* shade_out);
+/* Read-only views of work RAM (C000-DFFF, GB_WRAM_SIZE bytes) and high RAM (FF80-FFFE), valid until the pool is destroyed. */
+GB_API const uint8_t* gb_pool_wram(const gb_pool* pool, int env);
+GB_API const uint8_t* gb_pool_hram(const gb_pool* pool, int env);
+GB_API size_t gb_pool_state_size(gb_pool* pool);
+GB_API int gb_pool_save_state(gb_pool* pool, int env, void* buffer, size_t capacity);
+GB_API int gb_pool_load_state(gb_pool* pool, int env, const void* buffer, size_t size);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1000 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GB_SSE2 1
+#endif
+#ifdef GB_PROFILE
+#include <chrono>
+struct ProfileTimer { uint64_t& total; std::chrono::steady_clock::time_point start; ProfileTimer(uint64_t& t) : total(t), start(std::chrono::steady_clock::now()) {} ~ProfileTimer() { total += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(); } };
+#define GB_PROFILE_SCOPE(counter) ProfileTimer profileTimer_(counter)
+#else
+#define GB_PROFILE_SCOPE(counter)
+#endif
+using Byte = uint8_t; using Word = uint16_t; using SignedByte = int8_t;
+const int GB_WIDTH = 160; const int GB_HEIGHT = 144; const int SAMPLE_RATE = 44100;
+class APU; class MMU; class PPU; class CPU; class GameBoyCore;
+#ifndef _WIN32
+inline bool NarrowPath(const std::wstring& path, std::string& out) { out.assign(path.size() * 4 + 1, '\0'); size_t len = wcstombs(&out[0], path.c_str(), out.size()); if (len == (size_t)-1) return false; out.resize(len); return true; }
+#endif
+inline FILE* OpenFile(const std::wstring& path, const wchar_t* mode) {
+#ifdef _WIN32
+    FILE* fp = NULL; _wfopen_s(&fp, path.c_str(), mode); return fp;
+#else
+    std::string narrowPath, narrowMode(mode, mode + wcslen(mode)); if (!NarrowPath(path, narrowPath)) return NULL; return fopen(narrowPath.c_str(), narrowMode.c_str());
+#endif
+}
+inline bool WriteFileAtomic(const std::wstring& path, const void* data, size_t size) {
+    std::wstring temp = path + L".tmp"; FILE* fp = OpenFile(temp, L"wb"); if (!fp) return false; bool ok = fwrite(data, 1, size, fp) == size && fflush(fp) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(fp)) == 0; fclose(fp); return ok && MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    std::string narrowTemp, narrowPath; ok = ok && fsync(fileno(fp)) == 0; fclose(fp); return ok && NarrowPath(temp, narrowTemp) && NarrowPath(path, narrowPath) && rename(narrowTemp.c_str(), narrowPath.c_str()) == 0;
+#endif
+}
+inline int LowestBit(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long i; if (_BitScanForward(&i, (unsigned long)v)) return (int)i; _BitScanForward(&i, (unsigned long)(v >> 32)); return (int)i + 32;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+inline uint64_t HashBytes(uint64_t h, const void* data, size_t n) {
+    const Byte* p = (const Byte*)data; uint64_t w;
+    for (; n >= 8; p += 8, n -= 8) { memcpy(&w, p, 8); h = (h ^ w) * 0x9E3779B97F4A7C15ULL; h ^= h >> 29; }
+    for (; n; p++, n--) h = (h ^ *p) * 0x100000001B3ULL;
+    return h;
+}
+class RomImage {
+    std::vector<Byte> m_owned; const Byte* m_data; size_t m_size;
+#ifdef _WIN32
+    HANDLE m_file, m_mapping;
+    RomImage() : m_data(nullptr), m_size(0), m_file(INVALID_HANDLE_VALUE), m_mapping(NULL) {}
+#else
+    RomImage() : m_data(nullptr), m_size(0) {}
+#endif
+    bool Map(const std::wstring& path) {
+#ifdef _WIN32
+        m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); LARGE_INTEGER size;
+        if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart < 0x8000) return false;
+        m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL); if (!m_mapping) return false;
+        m_data = (const Byte*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0); if (!m_data) return false; m_size = (size_t)size.QuadPart; return true;
+#else
+        std::string narrowPath; if (!NarrowPath(path, narrowPath)) return false; int fd = open(narrowPath.c_str(), O_RDONLY); if (fd < 0) return false; struct stat st;
+        void* p = (fstat(fd, &st) == 0 && st.st_size >= 0x8000) ? mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED; close(fd);
+        if (p == MAP_FAILED) return false; m_data = (const Byte*)p; m_size = (size_t)st.st_size; return true;
+#endif
+    }
+public:
+    RomImage(const RomImage&) = delete; RomImage& operator=(const RomImage&) = delete;
+    ~RomImage() {
+#ifdef _WIN32
+        if (m_mapping) { if (m_data) UnmapViewOfFile(m_data); CloseHandle(m_mapping); } if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+        if (m_data && m_owned.empty()) munmap((void*)m_data, m_size);
+#endif
+    }
+    static std::shared_ptr<const RomImage> FromBytes(std::vector<Byte> bytes) {
+        std::shared_ptr<RomImage> image(new RomImage()); if (bytes.size() < 0x8000) bytes.resize(0x8000, 0);
+        image->m_owned = std::move(bytes); image->m_data = image->m_owned.data(); image->m_size = image->m_owned.size(); return image;
+    }
+    static std::shared_ptr<const RomImage> Open(const std::wstring& path) {
+        { std::shared_ptr<RomImage> image(new RomImage()); if (image->Map(path)) return image; }
+        FILE* fp = OpenFile(path, L"rb"); if (!fp) return nullptr;
+        fseek(fp, 0, SEEK_END); long size = ftell(fp); fseek(fp, 0, SEEK_SET); std::vector<Byte> buffer(size > 0 ? size : 0);
+        bool ok = size > 0 && fread(buffer.data(), 1, size, fp) == (size_t)size; fclose(fp); return ok ? FromBytes(std::move(buffer)) : nullptr;
+    }
+    const Byte* data() const { return m_data; } size_t size() const { return m_size; } Byte operator[](size_t i) const { return m_data[i]; }
+};
+template <class T, size_t N> class RingBuffer {
+    static_assert((N & (N - 1)) == 0, "RingBuffer capacity must be a power of two");
+    T data[N]; alignas(64) std::atomic<size_t> readPos; alignas(64) std::atomic<size_t> writePos;
+public:
+    RingBuffer() : readPos(0), writePos(0) {}
+    size_t Capacity() const { return N; } size_t Size() const { size_t r = readPos.load(std::memory_order_acquire); return writePos.load(std::memory_order_acquire) - r; }
+    size_t Free() const { return N - Size(); } bool Empty() const { return Size() == 0; }
+    void Clear() { readPos.store(writePos.load(std::memory_order_acquire), std::memory_order_release); }
+    size_t Write(const T* src, size_t count) {
+        size_t w = writePos.load(std::memory_order_relaxed); count = (std::min)(count, N - (w - readPos.load(std::memory_order_acquire))); size_t start = w & (N - 1), first = (std::min)(count, N - start);
+        memcpy(data + start, src, first * sizeof(T)); memcpy(data, src + first, (count - first) * sizeof(T)); writePos.store(w + count, std::memory_order_release); return count;
+    }
+    size_t Read(T* dst, size_t count) {
+        size_t r = readPos.load(std::memory_order_relaxed); count = (std::min)(count, writePos.load(std::memory_order_acquire) - r); size_t start = r & (N - 1), first = (std::min)(count, N - start);
+        memcpy(dst, data + start, first * sizeof(T)); memcpy(dst + first, data, (count - first) * sizeof(T)); readPos.store(r + count, std::memory_order_release); return count;
+    }
+    size_t Discard(size_t count) { size_t r = readPos.load(std::memory_order_relaxed); count = (std::min)(count, writePos.load(std::memory_order_acquire) - r); readPos.store(r + count, std::memory_order_release); return count; }
+};
+class BlipSynth {
+public:
+    static constexpr int PHASE_BITS = 5, PHASES = 1 << PHASE_BITS, HALF_WIDTH = 8, WIDTH = HALF_WIDTH * 2, KERNEL_BITS = 15, BASS_SHIFT = 9, TIME_BITS = 40, MAX_SAMPLES = 4096;
+private:
+    struct KernelTable {
+        int32_t taps[PHASES][WIDTH];
+        KernelTable() {
+            const double PI = 3.14159265358979323846;
+            for (int p = 0; p < PHASES; p++) {
+                double t[WIDTH], sum = 0; int total = 0;
+                for (int k = 0; k < WIDTH; k++) {
+                    double x = k - (HALF_WIDTH - 1) - (double)p / PHASES, w = (k + 1 - (double)p / PHASES) / WIDTH;
+                    t[k] = ((x == 0) ? 1.0 : sin(PI * x) / (PI * x)) * (0.42 - 0.5 * cos(2 * PI * w) + 0.08 * cos(4 * PI * w)); sum += t[k];
+                }
+                for (int k = 0; k < WIDTH; k++) { taps[p][k] = (int32_t)floor(t[k] / sum * (1 << KERNEL_BITS) + 0.5); total += taps[p][k]; }
+                taps[p][HALF_WIDTH - 1] += ((1 << KERNEL_BITS) - total);
+            }
+        }
+    };
+    static const int32_t* Kernel() { static const KernelTable table; return &table.taps[0][0]; }
+    int32_t buf[MAX_SAMPLES + WIDTH]; uint64_t factor, offset; int32_t integrator; const int32_t* kernel;
+public:
+    BlipSynth() : kernel(Kernel()) { SetRates(4194304.0, SAMPLE_RATE); Clear(); }
+    void SetRates(double clockRate, double sampleRate) { factor = (uint64_t)(sampleRate / clockRate * (double)(1ULL << TIME_BITS) + 0.5); }
+    void Clear() { memset(buf, 0, sizeof(buf)); offset = 0; integrator = 0; }
+    int SamplesAvailable() const { return (int)(offset >> TIME_BITS); }
+    void AddDelta(int clockTime, int delta) {
+        uint64_t pos = offset + (uint64_t)clockTime * factor; int index = (int)(pos >> TIME_BITS); if (index >= MAX_SAMPLES) return;
+        const int32_t* k = kernel + ((pos >> (TIME_BITS - PHASE_BITS)) & (PHASES - 1)) * WIDTH; int32_t* out = buf + index;
+        for (int i = 0; i < WIDTH; i++) out[i] += k[i] * delta;
+    }
+    void EndFrame(int clocks) { offset += (uint64_t)clocks * factor; if (SamplesAvailable() > MAX_SAMPLES) offset = (uint64_t)MAX_SAMPLES << TIME_BITS; }
+    int ReadSamples(int16_t* out, int count, int stride) {
+        count = (std::min)(count, SamplesAvailable()); int32_t sum = integrator;
+        for (int i = 0; i < count; i++) {
+            sum += buf[i]; int32_t s = sum >> KERNEL_BITS; if (s > 32767) s = 32767; else if (s < -32768) s = -32768;
+            out[i * stride] = (int16_t)s; sum -= s * (1 << (KERNEL_BITS - BASS_SHIFT));
+        }
+        integrator = sum; int remain = SamplesAvailable() + WIDTH - count;
+        memmove(buf, buf + count, remain * sizeof(int32_t)); memset(buf + remain, 0, count * sizeof(int32_t)); offset -= (uint64_t)count << TIME_BITS; return count;
+    }
+};
+using AudioRing = RingBuffer<int16_t, 16384>;
+class StateWriter {
+    Byte* m_out; size_t m_capacity, m_pos;
+public:
+    StateWriter(void* out, size_t capacity) : m_out((Byte*)out), m_capacity(capacity), m_pos(0) {}
+    void Raw(const void* p, size_t n) { if (m_out && m_pos + n <= m_capacity) memcpy(m_out + m_pos, p, n); m_pos += n; }
+    template <class T> void Value(const T& v) { Raw(&v, sizeof(T)); }
+    size_t Size() const { return m_pos; } bool Ok() const { return m_out && m_pos <= m_capacity; }
+};
+class StateReader {
+    const Byte* m_in; size_t m_capacity, m_pos;
+public:
+    StateReader(const void* in, size_t capacity) : m_in((const Byte*)in), m_capacity(capacity), m_pos(0) {}
+    void Raw(void* p, size_t n) { if (m_pos + n <= m_capacity) memcpy(p, m_in + m_pos, n); m_pos += n; }
+    template <class T> void Value(T& v) { Raw(&v, sizeof(T)); }
+    size_t Size() const { return m_pos; } bool Ok() const { return m_pos <= m_capacity; }
+};
+struct NullProbe {
+    static constexpr bool ENABLED = false;
+    void OnOpcode(Byte) {} void OnCBOpcode(Byte) {} void OnExec(int, Word) {} void OnRead(Word) {} void OnWrite(Word) {} void OnRomBankSwitch() {} void OnRamBankSwitch() {} void Clear() {} void Report(FILE*) const {}
+};
+struct CountingProbe {
+    static constexpr bool ENABLED = true;
+    enum Region { REG_ROM0, REG_ROMX, REG_VRAM, REG_SRAM, REG_WRAM, REG_ECHO, REG_OAM, REG_UNUSED, REG_IO, REG_HRAM, REG_IE, REG_COUNT };
+    uint64_t opcodes[256], cbOpcodes[256], reads[REG_COUNT], writes[REG_COUNT], romBankSwitches, ramBankSwitches; std::vector<uint32_t> romExec; uint32_t ramExec[0x8000];
+    CountingProbe() { Clear(); }
+    static int RegionOf(Word addr) {
+        if (addr < 0x4000) return REG_ROM0; if (addr < 0x8000) return REG_ROMX; if (addr < 0xA000) return REG_VRAM; if (addr < 0xC000) return REG_SRAM; if (addr < 0xE000) return REG_WRAM;
+        if (addr < 0xFE00) return REG_ECHO; if (addr < 0xFEA0) return REG_OAM; if (addr < 0xFF00) return REG_UNUSED; if (addr < 0xFF80) return REG_IO; if (addr < 0xFFFF) return REG_HRAM; return REG_IE;
+    }
+    void OnOpcode(Byte op) { opcodes[op]++; } void OnCBOpcode(Byte op) { cbOpcodes[op]++; }
+    void OnExec(int bank, Word pc) {
+        if (pc >= 0x8000) { ramExec[pc - 0x8000]++; return; }
+        size_t index = (size_t)bank * 0x4000 + (pc & 0x3FFF); if (index >= romExec.size()) romExec.resize((index | 0x3FFF) + 1, 0); romExec[index]++;
+    }
+    void OnRead(Word addr) { reads[RegionOf(addr)]++; } void OnWrite(Word addr) { writes[RegionOf(addr)]++; }
+    void OnRomBankSwitch() { romBankSwitches++; } void OnRamBankSwitch() { ramBankSwitches++; }
+    void Clear() { memset(opcodes, 0, sizeof(opcodes)); memset(cbOpcodes, 0, sizeof(cbOpcodes)); memset(reads, 0, sizeof(reads)); memset(writes, 0, sizeof(writes)); memset(ramExec, 0, sizeof(ramExec)); romExec.clear(); romBankSwitches = ramBankSwitches = 0; }
+    void Report(FILE* out) const {
+        static const char* REGION_NAMES[REG_COUNT] = { "ROM0", "ROMX", "VRAM", "SRAM", "WRAM", "ECHO", "OAM", "UNUSED", "IO", "HRAM", "IE" };
+        auto top = [](const uint64_t* counts, int n, int limit) { std::vector<int> order; for (int i = 0; i < n; i++) if (counts[i]) order.push_back(i); std::sort(order.begin(), order.end(), [&](int a, int b) { return counts[a] > counts[b]; }); if ((int)order.size() > limit) order.resize(limit); return order; };
+        uint64_t total = 0, cbTotal = 0; for (int i = 0; i < 256; i++) { total += opcodes[i]; cbTotal += cbOpcodes[i]; }
+        fprintf(out, "== opcodes (%llu executed) ==\n", (unsigned long long)total); for (int op : top(opcodes, 256, 32)) fprintf(out, "  %02X  %12llu  %5.2f%%\n", op, (unsigned long long)opcodes[op], 100.0 * opcodes[op] / total);
+        fprintf(out, "== CB opcodes (%llu executed) ==\n", (unsigned long long)cbTotal); for (int op : top(cbOpcodes, 256, 16)) fprintf(out, "  CB %02X  %12llu  %5.2f%%\n", op, (unsigned long long)cbOpcodes[op], 100.0 * cbOpcodes[op] / (cbTotal ? cbTotal : 1));
+        std::vector<std::pair<uint32_t, uint32_t>> hot;
+        for (size_t i = 0; i < romExec.size(); i++) if (romExec[i]) hot.push_back({ romExec[i], (uint32_t)i }); for (uint32_t i = 0; i < 0x8000; i++) if (ramExec[i]) hot.push_back({ ramExec[i], 0x80000000u | (0x8000 + i) });
+        std::sort(hot.begin(), hot.end(), [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) { return a.first > b.first; }); if (hot.size() > 32) hot.resize(32);
+        fprintf(out, "== hot PCs ==\n");
+        for (auto& h : hot) { if (h.second & 0x80000000u) fprintf(out, "  RAM:%04X  %12u\n", h.second & 0xFFFF, h.first); else { uint32_t bank = h.second / 0x4000, addr = (h.second & 0x3FFF) | (bank ? 0x4000 : 0); fprintf(out, "  %03X:%04X  %12u\n", bank, addr, h.first); } }
+        fprintf(out, "== memory regions ==\n"); for (int r = 0; r < REG_COUNT; r++) if (reads[r] || writes[r]) fprintf(out, "  %-6s  reads %12llu  writes %12llu\n", REGION_NAMES[r], (unsigned long long)reads[r], (unsigned long long)writes[r]);
+        fprintf(out, "== bank switches ==\n  ROM %llu  RAM %llu\n", (unsigned long long)romBankSwitches, (unsigned long long)ramBankSwitches);
+    }
+};
+#ifdef GB_INSTRUMENT
+using Probe = CountingProbe;
+#else
+using Probe = NullProbe;
+#endif
+class Scheduler {
+public:
+    enum Event { EVT_PPU, EVT_TIMER, EVT_RTC, EVT_COUNT };
+    enum ProfileSlot { PROF_FRAME, PROF_PPU, PROF_APU, PROF_TIMERS, PROF_COUNT };
+    static constexpr uint64_t NEVER = ~0ULL; static constexpr int RTC_POLL_CYCLES = 16384;
+    uint64_t now, nextEvent, when[EVT_COUNT], ppuSync, timerSync, apuSync, profileNs[PROF_COUNT]; PPU* ppu; MMU* mmu; APU* apu;
+    Scheduler() : ppu(nullptr), mmu(nullptr), apu(nullptr) { Reset(); ClearProfile(); }
+    void ClearProfile() { for (int i = 0; i < PROF_COUNT; i++) profileNs[i] = 0; }
+    void Reset() { now = 0; ppuSync = timerSync = apuSync = 0; for (int i = 0; i < EVT_COUNT; i++) when[i] = 0; nextEvent = 0; }
+    void Schedule(int evt, uint64_t at) { when[evt] = at; nextEvent = *(std::min_element)(when, when + EVT_COUNT); }
+    void SyncPPU(); void SyncTimers(); void SyncAPU(); void SyncAll(); void RunDueEvents();
+    template <class S> void SerializeState(S& s) { s.Value(now); s.Value(nextEvent); s.Raw(when, sizeof(when)); s.Value(ppuSync); s.Value(timerSync); s.Value(apuSync); }
+};
+class APU {
+public:
+    Byte regs[0x40]; Byte waveRam[0x10];
+    struct Sweep { int period; int timer; bool enabled; int shadowFreq; };
+    struct Channel { bool enabled; int lengthCounter; int envelopeVolume; int envelopeTimer; int freqTimer; int dutyPos; int period; Sweep sweep; } ch1, ch2, ch3, ch4;
+    int frameSequencer, frameStep, noiseCounter, blipClock, outL, outR; uint64_t sampleHash; bool muted = false; double rateAdjust = 1.0; const int CLOCK_RATE = 4194304; BlipSynth blipL, blipR; AudioRing buffer;
+    const int dutyPatterns[4][8] = { {0,0,0,0,0,0,0,1}, {1,0,0,0,0,0,0,1}, {1,0,0,0,0,1,1,1}, {0,1,1,1,1,1,1,0} }; uint16_t lfsr;
+    APU() { Reset(); }
+    template <class S> void SerializeState(S& s) {
+        s.Raw(regs, sizeof(regs)); s.Raw(waveRam, sizeof(waveRam)); s.Value(ch1); s.Value(ch2); s.Value(ch3); s.Value(ch4);
+        s.Value(frameSequencer); s.Value(frameStep); s.Value(noiseCounter); s.Value(lfsr);
+    }
+    void Reset() { ResetChannels(); ResetOutput(); buffer.Clear(); }
+    void SetRateAdjust(double ratio) { if (ratio == rateAdjust) return; rateAdjust = ratio; blipL.SetRates(CLOCK_RATE, SAMPLE_RATE * ratio); blipR.SetRates(CLOCK_RATE, SAMPLE_RATE * ratio); }
+    void ResetOutput() { blipL.Clear(); blipR.Clear(); blipClock = 0; outL = outR = 0; sampleHash = 0; }
+    void ResetChannels() {
+        memset(regs, 0, sizeof(regs)); memset(waveRam, 0, sizeof(waveRam)); frameSequencer = 0; frameStep = 0; noiseCounter = 0;
+        memset(&ch1, 0, sizeof(Channel)); memset(&ch2, 0, sizeof(Channel)); memset(&ch3, 0, sizeof(Channel)); memset(&ch4, 0, sizeof(Channel));
+        lfsr = 0x7FFF; regs[0x26] = 0xF1;
+    }
+    Byte Read(Word addr) {
+        if (addr >= 0xFF30 && addr <= 0xFF3F) return waveRam[addr - 0xFF30];
+        if (addr >= 0xFF10 && addr <= 0xFF3F) {
+            int r = addr - 0xFF00; Byte val = regs[r];
+            if (addr == 0xFF26) { val = (val & 0xF0); if (ch1.enabled) val |= 0x01; if (ch2.enabled) val |= 0x02; if (ch3.enabled) val |= 0x04; if (ch4.enabled) val |= 0x08; }
+            return val;
+        }
+        return 0xFF;
+    }
+    void Write(Word addr, Byte value) {
+        if (addr >= 0xFF30 && addr <= 0xFF3F) { waveRam[addr - 0xFF30] = value; return; }
+        if (addr >= 0xFF10 && addr <= 0xFF3F) {
+            int r = addr - 0xFF00; regs[r] = value;
+            if (r == 0x14 && (value & 0x80)) TriggerCh1(); if (r == 0x19 && (value & 0x80)) TriggerCh2();
+            if (r == 0x1E && (value & 0x80)) TriggerCh3(); if (r == 0x23 && (value & 0x80)) TriggerCh4();
+            if (r == 0x26) { if (!(value & 0x80)) { ResetChannels(); regs[0x26] = 0x00; } }
+        }
+        UpdateOutput();
+    }
+    int CalcNewFreq() {
+        int shift = regs[0x10] & 0x07; int diff = ch1.sweep.shadowFreq >> shift;
+        int newFreq = ch1.sweep.shadowFreq; if (regs[0x10] & 0x08) newFreq -= diff; else newFreq += diff; return newFreq;
+    }
+    void TriggerCh1() {
+        ch1.enabled = true; int lenVal = regs[0x11] & 0x3F; ch1.lengthCounter = lenVal ? (64 - lenVal) : 64;
+        ch1.envelopeVolume = (regs[0x12] >> 4); ch1.envelopeTimer = (regs[0x12] & 0x07);
+        ch1.period = (2048 - ((regs[0x14] & 7) << 8 | regs[0x13])) * 4; ch1.freqTimer = ch1.period;
+        int sweepPeriod = (regs[0x10] >> 4) & 0x07; int sweepShift = regs[0x10] & 0x07;
+        ch1.sweep.period = sweepPeriod ? sweepPeriod : 8; ch1.sweep.timer = ch1.sweep.period;
+        ch1.sweep.shadowFreq = ((regs[0x14] & 7) << 8 | regs[0x13]); ch1.sweep.enabled = (sweepPeriod > 0 || sweepShift > 0);
+        if (sweepShift > 0) { if (CalcNewFreq() > 2047) ch1.enabled = false; }
+    }
+    void TriggerCh2() {
+        ch2.enabled = true; int lenVal = regs[0x16] & 0x3F; ch2.lengthCounter = lenVal ? (64 - lenVal) : 64;
+        ch2.envelopeVolume = (regs[0x17] >> 4); ch2.envelopeTimer = (regs[0x17] & 0x07);
+        ch2.period = (2048 - ((regs[0x19] & 7) << 8 | regs[0x18])) * 4; ch2.freqTimer = ch2.period;
+    }
+    void TriggerCh3() {
+        ch3.enabled = true; int lenVal = regs[0x1B]; ch3.lengthCounter = (256 - lenVal);
+        ch3.period = (2048 - ((regs[0x1E] & 7) << 8 | regs[0x1D])) * 2; ch3.freqTimer = ch3.period; ch3.dutyPos = 0;
+    }
+    void TriggerCh4() {
+        ch4.enabled = true; int lenVal = regs[0x20] & 0x3F; ch4.lengthCounter = lenVal ? (64 - lenVal) : 64;
+        ch4.envelopeVolume = (regs[0x21] >> 4); ch4.envelopeTimer = (regs[0x21] & 0x07); lfsr = 0x7FFF;
+    }
+    int NoisePeriod() const { int divCode = regs[0x22] & 7; int shift = (regs[0x22] >> 4) & 0xF; return (divCode ? (divCode << 4) : 8) << shift; }
+    int NextBoundary(int limit) const {
+        int n = (std::min)(limit, 8192 - frameSequencer);
+        if (ch1.enabled) n = (std::min)(n, ch1.freqTimer); if (ch2.enabled) n = (std::min)(n, ch2.freqTimer);
+        if (ch3.enabled && (regs[0x1A] & 0x80)) n = (std::min)(n, ch3.freqTimer); if (ch4.enabled) n = (std::min)(n, NoisePeriod() - noiseCounter);
+        return (n > 0) ? n : 1;
+    }
+    void SetMuted(bool m) { muted = m; }
+    void Step(int cycles) { if (muted) { StepMuted(cycles); return; } while (cycles > 0) { int n = NextBoundary(cycles); Advance(n); blipClock += n; cycles -= n; UpdateOutput(); } }
+    void StepMuted(int cycles) {
+        while (cycles > 0) {
+            int untilTick = 8192 - frameSequencer, last = 0; bool settled = true;
+            auto Boundary = [&](int timer, int period) { if (timer <= 0) settled = false; else if (timer < untilTick) last = (std::max)(last, timer + (untilTick - 1 - timer) / period * period); };
+            if (ch1.enabled) Boundary(ch1.freqTimer, (2048 - ((regs[0x14] & 7) << 8 | regs[0x13])) * 4); if (ch2.enabled) Boundary(ch2.freqTimer, (2048 - ((regs[0x19] & 7) << 8 | regs[0x18])) * 4);
+            if (ch3.enabled && (regs[0x1A] & 0x80)) Boundary(ch3.freqTimer, (2048 - ((regs[0x1E] & 7) << 8 | regs[0x1D])) * 2); if (ch4.enabled) Boundary(NoisePeriod() - noiseCounter, NoisePeriod());
+            if (!settled) { int n = NextBoundary(cycles); Advance(n); cycles -= n; continue; }
+            if (cycles < untilTick) { AdvanceTimers(cycles); return; }
+            AdvanceTimers(last); Advance(untilTick - last); cycles -= untilTick;
+        }
+    }
+    void AdvanceTimers(int cycles) {
+        auto Run = [cycles](int& timer, int& pos, int mask, int period) { timer -= cycles; if (timer <= 0) { int k = 1 + (-timer) / period; timer += k * period; pos = (pos + k) & mask; } };
+        frameSequencer += cycles;
+        if (ch1.enabled) Run(ch1.freqTimer, ch1.dutyPos, 7, (2048 - ((regs[0x14] & 7) << 8 | regs[0x13])) * 4); if (ch2.enabled) Run(ch2.freqTimer, ch2.dutyPos, 7, (2048 - ((regs[0x19] & 7) << 8 | regs[0x18])) * 4);
+        if (ch3.enabled && (regs[0x1A] & 0x80)) Run(ch3.freqTimer, ch3.dutyPos, 31, (2048 - ((regs[0x1E] & 7) << 8 | regs[0x1D])) * 2); if (ch4.enabled) ClockNoise(cycles);
+    }
+    void ClockNoise(int cycles) { int timerPeriod = NoisePeriod(); noiseCounter += cycles; while (noiseCounter >= timerPeriod) { noiseCounter -= timerPeriod; int xorBit = (lfsr & 1) ^ ((lfsr >> 1) & 1); lfsr >>= 1; lfsr |= (xorBit << 14); if (regs[0x22] & 8) { lfsr &= ~(1 << 6); lfsr |= (xorBit << 6); } } }
+    void EndFrame() {
+        if (muted) return;
+        blipL.EndFrame(blipClock); blipR.EndFrame(blipClock); blipClock = 0; int16_t samples[512 * 2];
+        for (int n; (n = blipL.ReadSamples(samples, 512, 2)) > 0;) { blipR.ReadSamples(samples + 1, n, 2); sampleHash = HashBytes(sampleHash, samples, n * 2 * sizeof(int16_t)); buffer.Write(samples, n * 2); }
+    }
+    void Advance(int cycles) {
+        frameSequencer += cycles;
+        if (frameSequencer >= 8192) {
+            frameSequencer -= 8192; int step = frameStep = (frameStep + 1) & 7;
+            if (!(step & 1)) {
+                if ((regs[0x14] & 0x40) && ch1.lengthCounter > 0 && --ch1.lengthCounter == 0) ch1.enabled = false;
+                if ((regs[0x19] & 0x40) && ch2.lengthCounter > 0 && --ch2.lengthCounter == 0) ch2.enabled = false;
+                if ((regs[0x1E] & 0x40) && ch3.lengthCounter > 0 && --ch3.lengthCounter == 0) ch3.enabled = false;
+                if ((regs[0x23] & 0x40) && ch4.lengthCounter > 0 && --ch4.lengthCounter == 0) ch4.enabled = false;
+            }
+            if (step == 2 || step == 6) {
+                if (ch1.sweep.enabled && ch1.enabled) {
+                    if (--ch1.sweep.timer <= 0) {
+                        int period = (regs[0x10] >> 4) & 0x07; ch1.sweep.timer = period ? period : 8;
+                        if (period > 0) {
+                            int newFreq = CalcNewFreq();
+                            if (newFreq <= 2047 && (regs[0x10] & 0x07) > 0) {
+                                ch1.sweep.shadowFreq = newFreq; regs[0x13] = newFreq & 0xFF; regs[0x14] = (regs[0x14] & 0xF8) | ((newFreq >> 8) & 0x07);
+                                ch1.period = (2048 - newFreq) * 4; if (CalcNewFreq() > 2047) ch1.enabled = false;
+                            } else if (newFreq > 2047) ch1.enabled = false;
+                        }
+                    }
+                }
+            }
+            if (step == 7) {
+                auto DoEnv = [&](Channel& ch, Byte reg) {
+                    if (ch.enabled && (reg & 7) && --ch.envelopeTimer <= 0) {
+                        ch.envelopeTimer = reg & 7; if (reg & 8) { if (ch.envelopeVolume < 15) ch.envelopeVolume++; }
+                        else { if (ch.envelopeVolume > 0) ch.envelopeVolume--; }
+                    }
+                };
+                DoEnv(ch1, regs[0x12]); DoEnv(ch2, regs[0x17]); DoEnv(ch4, regs[0x21]);
+            }
+        }
+        if (ch1.enabled) { ch1.freqTimer -= cycles; if (ch1.freqTimer <= 0) { ch1.freqTimer += (2048 - ((regs[0x14] & 7) << 8 | regs[0x13])) * 4; ch1.dutyPos = (ch1.dutyPos + 1) & 7; } }
+        if (ch2.enabled) { ch2.freqTimer -= cycles; if (ch2.freqTimer <= 0) { ch2.freqTimer += (2048 - ((regs[0x19] & 7) << 8 | regs[0x18])) * 4; ch2.dutyPos = (ch2.dutyPos + 1) & 7; } }
+        if (ch3.enabled && (regs[0x1A] & 0x80)) { ch3.freqTimer -= cycles; if (ch3.freqTimer <= 0) { ch3.freqTimer += (2048 - ((regs[0x1E] & 7) << 8 | regs[0x1D])) * 2; ch3.dutyPos = (ch3.dutyPos + 1) & 31; } }
+        if (ch4.enabled) ClockNoise(cycles);
+    }
+    void UpdateOutput() {
+        if (muted) return;
+        int s1 = 0; if (ch1.enabled && dutyPatterns[regs[0x11] >> 6][ch1.dutyPos]) s1 = ch1.envelopeVolume;
+        int s2 = 0; if (ch2.enabled && dutyPatterns[regs[0x16] >> 6][ch2.dutyPos]) s2 = ch2.envelopeVolume;
+        int s3 = 0; if (ch3.enabled && (regs[0x1A] & 0x80)) { Byte b = waveRam[ch3.dutyPos / 2]; int s = (ch3.dutyPos % 2 == 0) ? (b >> 4) : (b & 0xF); int vCode = (regs[0x1C] >> 5) & 3; if (vCode == 0) s3 = 0; else if (vCode == 1) s3 = s; else if (vCode == 2) s3 = s >> 1; else if (vCode == 3) s3 = s >> 2; }
+        int s4 = 0; if (ch4.enabled && !(lfsr & 1)) s4 = ch4.envelopeVolume;
+        int l = 0, r = 0; Byte nr51 = regs[0x25];
+        if (nr51 & 0x01) r += s1; if (nr51 & 0x10) l += s1; if (nr51 & 0x02) r += s2; if (nr51 & 0x20) l += s2;
+        if (nr51 & 0x04) r += s3; if (nr51 & 0x40) l += s3; if (nr51 & 0x08) r += s4; if (nr51 & 0x80) l += s4;
+        Byte nr50 = regs[0x24]; int volL = (nr50 >> 4) & 7; int volR = nr50 & 7; l = l * (volL + 1) * 30; r = r * (volR + 1) * 30;
+        if (l != outL) { blipL.AddDelta(blipClock, l - outL); outL = l; } if (r != outR) { blipR.AddDelta(blipClock, r - outR); outR = r; }
+    }
+};
+struct MemoryRegion {
+    Byte* ptr = nullptr; size_t count = 0;
+    Byte* data() const { return ptr; } size_t size() const { return count; } Byte& operator[](size_t i) const { return ptr[i]; }
+};
+class MMU {
+public:
+    static constexpr size_t IO_OFFSET = 0, HRAM_OFFSET = 0x80, OAM_OFFSET = 0x100, WRAM_OFFSET = 0x200, VRAM_OFFSET = 0x2200, SRAM_OFFSET = 0x4200;
+    alignas(64) Byte interruptFlag; Byte interruptEnable, joypadButtons, joypadDir; int mbcType, romBank, ramBank, bankingMode, divCounter, tacCounter; size_t ramSizeMask;
+    bool ramEnable, rtcMapped, hasBattery, emulatedClock = false; APU* apu; Scheduler* sched; MemoryRegion io, hram, oam, wram, vram, sram;
+    Byte rtcS, rtcM, rtcH, rtcDL, rtcDH, rtcLatch; time_t lastTime; std::shared_ptr<const RomImage> rom; std::unique_ptr<Byte[]> arena; size_t arenaSize = 0;
+    const Byte* readMap[0x100]; Byte* writeMap[0x100]; int romBankCount, mappedBank0, mappedBank1; Byte tileCache[384 * 64]; uint64_t spriteRows[144]; bool codeMarked[0x100]; uint32_t codeGeneration[0x100], sideEffects; uint64_t sramDirty[8]; Probe probe;
+    static constexpr size_t RTC_FOOTER_SIZE = 48;
+    MMU() : apu(nullptr), sched(nullptr), mappedBank0(0), mappedBank1(1) { memset(codeMarked, 0, sizeof(codeMarked)); memset(codeGeneration, 0, sizeof(codeGeneration)); sideEffects = 0; LayoutArena(0); Reset(); }
+    MMU(const MMU&) = delete; MMU& operator=(const MMU&) = delete;
+    void LayoutArena(size_t sramSize) {
+        if (!arena || arenaSize != SRAM_OFFSET + sramSize) { std::unique_ptr<Byte[]> next(new Byte[SRAM_OFFSET + sramSize]()); if (arena) memcpy(next.get(), arena.get(), SRAM_OFFSET); arena = std::move(next); arenaSize = SRAM_OFFSET + sramSize; }
+        Byte* base = arena.get(); io = { base + IO_OFFSET, 0x80 }; hram = { base + HRAM_OFFSET, 0x80 }; oam = { base + OAM_OFFSET, 0xA0 };
+        wram = { base + WRAM_OFFSET, 0x2000 }; vram = { base + VRAM_OFFSET, 0x2000 }; sram = { base + SRAM_OFFSET, sramSize };
+    }
+    void SetAPU(APU* p) { apu = p; } void SetScheduler(Scheduler* p) { sched = p; }
+    template <class S> void SerializeState(S& s) {
+        s.Value(interruptFlag); s.Value(interruptEnable); s.Value(joypadButtons); s.Value(joypadDir); s.Value(rtcS); s.Value(rtcM); s.Value(rtcH); s.Value(rtcDL); s.Value(rtcDH); s.Value(rtcLatch);
+        s.Value(mbcType); s.Value(romBank); s.Value(ramBank); s.Value(bankingMode); s.Value(divCounter); s.Value(tacCounter); s.Value(ramEnable); s.Value(hasBattery); s.Value(rtcMapped); s.Value(ramSizeMask);
+        s.Raw(vram.data(), vram.size()); s.Raw(wram.data(), wram.size()); s.Raw(hram.data(), hram.size()); s.Raw(io.data(), io.size()); s.Raw(oam.data(), oam.size());
+        size_t sramSize = ramSizeMask ? (std::min)(ramSizeMask + 1, sram.size()) : 0; s.Raw(sram.data(), sramSize);
+    }
+    void Reset() {
+        memset(arena.get(), 0, arenaSize);
+        if (!rom) { static const std::shared_ptr<const RomImage> blank = RomImage::FromBytes({}); rom = blank; }
+        interruptFlag = 0; interruptEnable = 0; mbcType = 0; ramEnable = false; romBank = 1; ramBank = 0; bankingMode = 0;
+        divCounter = 0; tacCounter = 0; rtcMapped = false; rtcS = rtcM = rtcH = rtcDL = rtcDH = rtcLatch = 0; lastTime = ClockNow();
+        joypadButtons = 0x0F; joypadDir = 0x0F; hasBattery = false; ramSizeMask = 0; memset(sramDirty, 0, sizeof(sramDirty)); UpdateMemoryMap(); DecodeAllTiles(); IndexAllSprites();
+    }
+    void DecodeTileRow(int row) {
+        Byte b1 = vram[row * 2], b2 = vram[row * 2 + 1]; Byte* out = tileCache + row * 8;
+        for (int x = 0; x < 8; x++) { int bit = 7 - x; out[x] = ((b1 >> bit) & 1) | (((b2 >> bit) & 1) << 1); }
+    }
+    void DecodeAllTiles() { for (int row = 0; row < 384 * 8; row++) DecodeTileRow(row); }
+    void IndexSprite(int sprite, Byte y, bool present) { uint64_t bit = 1ULL << sprite; for (int line = (std::max)(y - 16, 0), end = (std::min)((int)y, 144); line < end; line++) spriteRows[line] = present ? (spriteRows[line] | bit) : (spriteRows[line] & ~bit); }
+    void IndexAllSprites() { memset(spriteRows, 0, sizeof(spriteRows)); for (int i = 0; i < 40; i++) IndexSprite(i, oam[i * 4], true); }
+    void WriteOAM(int offset, Byte value) { if (!(offset & 3) && oam[offset] != value) { IndexSprite(offset >> 2, oam[offset], false); IndexSprite(offset >> 2, value, true); } oam[offset] = value; }
+    void UpdateRomMap() {
+        int bank0 = 0; if (mbcType == 1 && bankingMode == 1) bank0 = (ramBank << 5) % romBankCount;
+        int bank1 = romBank; if (mbcType == 1 && bankingMode == 0) bank1 |= (ramBank << 5); if (mbcType == 4) bank1 |= (ramBank << 6); bank1 %= romBankCount;
+        if (bank1 != mappedBank1) probe.OnRomBankSwitch(); mappedBank0 = bank0; mappedBank1 = bank1; const Byte* lo = rom->data() + bank0 * 0x4000; const Byte* hi = rom->data() + bank1 * 0x4000;
+        for (int page = 0; page < 0x40; page++) { readMap[page] = lo + (page << 8); readMap[0x40 + page] = hi + (page << 8); }
+    }
+    void UpdateMemoryMap() {
+        romBankCount = (int)(rom->size() / 0x4000); if (romBankCount == 0) romBankCount = 1; UpdateRomMap();
+        for (int page = 0x80; page < 0x100; page++) { readMap[page] = nullptr; writeMap[page] = nullptr; } for (int page = 0; page < 0x80; page++) writeMap[page] = nullptr;
+        for (int page = 0x80; page < 0xA0; page++) readMap[page] = vram.data() + ((page - 0x80) << 8);
+        for (int page = 0x98; page < 0xA0; page++) writeMap[page] = vram.data() + ((page - 0x80) << 8);
+        for (int page = 0xC0; page < 0xFE; page++) readMap[page] = writeMap[page] = wram.data() + (((page - 0xC0) << 8) & 0x1FFF);
+        for (int page = 0; page < 0x100; page++) if (codeMarked[page]) { codeMarked[page] = false; codeGeneration[page]++; if (page > 0) codeGeneration[page - 1]++; }
+    }
+    void MarkCode(int page) {
+        if (codeMarked[page]) return; codeMarked[page] = true;
+        if (page >= 0xC0 && page < 0xE0) { writeMap[page] = nullptr; if (page + 0x20 < 0xFE) writeMap[page + 0x20] = nullptr; }
+    }
+    void InvalidateCode(int page) {
+        sideEffects++; codeGeneration[page]++; if (page > 0) codeGeneration[page - 1]++; if (!codeMarked[page]) return; codeMarked[page] = false;
+        if (page >= 0xC0 && page < 0xE0) { writeMap[page] = wram.data() + ((page - 0xC0) << 8); if (page + 0x20 < 0xFE) writeMap[page + 0x20] = writeMap[page]; }
+    }
+    void LoadRomData(std::shared_ptr<const RomImage> image) {
+        rom = std::move(image); Byte type = (*rom)[0x0147];
+        if (type == 0x05 || type == 0x06) mbcType = 2; else if (type >= 0x0F && type <= 0x13) mbcType = 3;
+        else if (type >= 0x01 && type <= 0x03) mbcType = 1; else if (type >= 0x19 && type <= 0x1E) mbcType = 5; else if (type == 0xFF) mbcType = 4; else mbcType = 0;
+        hasBattery = (type == 0x03 || type == 0x06 || type == 0x09 || type == 0x0F || type == 0x10 || type == 0x13 || type == 0x1B || type == 0x1E || type == 0xFF);
+        ramEnable = false; romBank = 1; ramBank = 0; bankingMode = 0; rtcMapped = false; Byte ramSizeCode = (*rom)[0x0149];
+        switch (ramSizeCode) { case 0x01: ramSizeMask = 0x07FF; break; case 0x02: ramSizeMask = 0x1FFF; break; case 0x03: ramSizeMask = 0x7FFF; break; case 0x04: ramSizeMask = 0x1FFFF; break; case 0x05: ramSizeMask = 0xFFFF; break; default: ramSizeMask = 0; break; }
+        if (mbcType == 2) ramSizeMask = 0x1FF;
+        LayoutArena(ramSizeMask ? ramSizeMask + 1 : 0); memset(sram.data(), 0, sram.size()); UpdateMemoryMap();
+    }
+    bool HasRTC() const { Byte type = (*rom)[0x0147]; return type == 0x0F || type == 0x10; }
+    size_t BatteryRamSize() const { return ramSizeMask ? (std::min)(ramSizeMask + 1, sram.size()) : 0; }
+    void MarkSramDirty(size_t offset) { sramDirty[offset >> 14] |= 1ULL << ((offset >> 8) & 63); }
+    bool SramDirty() const { for (uint64_t bits : sramDirty) if (bits) return true; return false; }
+    void LoadRAM(const std::wstring& path) {
+        if (!hasBattery) return; FILE* fp = OpenFile(path, L"rb"); if (!fp) return;
+        fseek(fp, 0, SEEK_END); long fileSize = ftell(fp); fseek(fp, 0, SEEK_SET); std::vector<Byte> data(fileSize > 0 ? fileSize : 0); data.resize(fread(data.data(), 1, data.size(), fp)); fclose(fp);
+        size_t ramBytes = BatteryRamSize(); memcpy(sram.data(), data.data(), (std::min)(data.size(), ramBytes));
+        if (HasRTC() && data.size() >= ramBytes + RTC_FOOTER_SIZE - 4) {
+            uint32_t regs[5]; memcpy(regs, &data[ramBytes], sizeof(regs)); rtcS = (Byte)regs[0]; rtcM = (Byte)regs[1]; rtcH = (Byte)regs[2]; rtcDL = (Byte)regs[3]; rtcDH = (Byte)regs[4];
+            uint64_t saved = 0; memcpy(&saved, &data[ramBytes + 40], (std::min)(data.size() - ramBytes - 40, sizeof(saved))); uint64_t now = (uint64_t)time(NULL);
+            if (!emulatedClock && now > saved) AdvanceRTC(now - saved);
+        }
+    }
+    bool CollectSave(std::vector<Byte>& image, bool full) {
+        size_t ramBytes = BatteryRamSize(); bool rtc = HasRTC(); if (!hasBattery || (!ramBytes && !rtc)) return false;
+        size_t size = ramBytes + (rtc ? RTC_FOOTER_SIZE : 0); bool changed = full || image.size() != size; image.resize(size);
+        if (changed) memcpy(image.data(), sram.data(), ramBytes);
+        else for (size_t w = 0; w < 8; w++) for (uint64_t bits = sramDirty[w]; bits; bits &= bits - 1) { size_t offset = (w * 64 + LowestBit(bits)) << 8; if (offset < ramBytes) { memcpy(&image[offset], &sram[offset], (std::min)((size_t)0x100, ramBytes - offset)); changed = true; } }
+        memset(sramDirty, 0, sizeof(sramDirty));
+        if (rtc) { uint32_t regs[10] = { rtcS, rtcM, rtcH, rtcDL, rtcDH, rtcS, rtcM, rtcH, rtcDL, rtcDH }; uint64_t now = (uint64_t)time(NULL); memcpy(&image[ramBytes], regs, sizeof(regs)); memcpy(&image[ramBytes + 40], &now, sizeof(now)); }
+        return changed;
+    }
+    void SaveRAM(const std::wstring& path) { std::vector<Byte> image; if (CollectSave(image, true)) WriteFileAtomic(path, image.data(), image.size()); }
+    void RequestInterrupt(int bit) { interruptFlag |= (1 << bit); }
+    void DoDMA(Byte value) { Word srcBase = value << 8; for (int i = 0; i < 0xA0; i++) WriteOAM(i, Read(srcBase + i)); }
+    time_t ClockNow() const;
+    void AdvanceRTC(uint64_t seconds) {
+        if (rtcDH & 0x40) return; uint64_t days = rtcDL | ((rtcDH & 1) << 8), total = ((days * 24 + rtcH) * 60 + rtcM) * 60 + rtcS + seconds; days = total / 86400;
+        rtcS = (Byte)(total % 60); rtcM = (Byte)(total / 60 % 60); rtcH = (Byte)(total / 3600 % 24); rtcDL = (Byte)days; rtcDH = (Byte)((rtcDH & 0xFE) | ((days >> 8) & 1) | (days > 511 ? 0x80 : 0));
+    }
+    void UpdateRTC() {
+        if (mbcType != 3) return; time_t now = ClockNow();
+        if (now > lastTime) { lastTime = now; if (!(rtcDH & 0x40)) { rtcS++; if (rtcS >= 60) { rtcS = 0; rtcM++; } if (rtcM >= 60) { rtcM = 0; rtcH++; } if (rtcH >= 24) { rtcH = 0; rtcDL++; if (rtcDL == 0) rtcDH |= 1; } } }
+    }
+    void UpdateTimers(int cycles) {
+        divCounter += cycles; while (divCounter >= 256) { io[0x04]++; divCounter -= 256; }
+        if (io[0x07] & 0x04) {
+            tacCounter += cycles; int threshold = 1024;
+            switch (io[0x07] & 0x03) { case 0: threshold = 1024; break; case 1: threshold = 16; break; case 2: threshold = 64; break; case 3: threshold = 256; break; }
+            while (tacCounter >= threshold) { tacCounter -= threshold; if (io[0x05] == 0xFF) { io[0x05] = io[0x06]; RequestInterrupt(2); } else { io[0x05]++; } }
+        }
+    }
+    int CyclesUntilTimerOverflow() const {
+        if (!(io[0x07] & 0x04)) return -1; int threshold = 1024;
+        switch (io[0x07] & 0x03) { case 0: threshold = 1024; break; case 1: threshold = 16; break; case 2: threshold = 64; break; case 3: threshold = 256; break; }
+        int cycles = (0x100 - io[0x05]) * threshold - tacCounter; return (cycles > 0) ? cycles : 1;
+    }
+    void CheckJoypadInterrupt() {
+        Byte select = io[0x00]; bool req = false;
+        if (!(select & 0x10) && (joypadDir & 0x0F) != 0x0F) req = true;
+        if (!(select & 0x20) && (joypadButtons & 0x0F) != 0x0F) req = true;
+        if (req) RequestInterrupt(4);
+    }
+    Byte GetJoypadState() { Byte select = io[0x00]; Byte result = 0xCF | select; if (!(select & 0x10)) result &= (0xF0 | joypadDir); if (!(select & 0x20)) result &= (0xF0 | joypadButtons); return result; }
+    Byte Read(Word addr) { probe.OnRead(addr); const Byte* page = readMap[addr >> 8]; if (page) return page[addr & 0xFF]; return ReadSlow(addr); }
+    void Write(Word addr, Byte value) { probe.OnWrite(addr); Byte* page = writeMap[addr >> 8]; if (page) { page[addr & 0xFF] = value; return; } WriteSlow(addr, value); }
+    Byte ReadSlow(Word addr) {
+        if (addr < 0xC000) {
+            if (!ramEnable) return 0xFF;
+            if (mbcType == 3 && rtcMapped) { sideEffects++; UpdateRTC(); switch (ramBank) { case 0x08: return rtcS; case 0x09: return rtcM; case 0x0A: return rtcH; case 0x0B: return rtcDL; case 0x0C: return rtcDH; default: return 0xFF; } }
+            else if (mbcType == 2) return (sram[(addr - 0xA000) & ramSizeMask] & 0x0F) | 0xF0;
+            else { if (ramSizeMask == 0) return 0xFF; int bank = 0; if (mbcType == 1) bank = (bankingMode == 1) ? ramBank : 0; else if (mbcType == 3 || mbcType == 5 || mbcType == 4) bank = ramBank; return sram[((bank * 0x2000) + (addr - 0xA000)) & ramSizeMask]; }
+        }
+        if (addr < 0xFEA0) return oam[addr - 0xFE00]; if (addr < 0xFF00) return 0xFF;
+        if (addr == 0xFF00) return GetJoypadState(); if (addr == 0xFF0F) return interruptFlag;
+        if (addr >= 0xFF10 && addr <= 0xFF3F) { if (apu) { if (sched) sched->SyncAPU(); return apu->Read(addr); } return 0xFF; }
+        if (sched && addr >= 0xFF04 && addr <= 0xFF07) { sideEffects++; sched->SyncTimers(); } if (sched && addr >= 0xFF40 && addr <= 0xFF4B) { sideEffects++; sched->SyncPPU(); }
+        if (addr < 0xFF80) return io[addr - 0xFF00]; if (addr < 0xFFFF) return hram[addr - 0xFF80];
+        if (addr == 0xFFFF) return interruptEnable; return 0xFF;
+    }
+    void WriteSlow(Word addr, Byte value) {
+        if (addr < 0x8000) {
+            int prevRamBank = ramBank; sideEffects++;
+            if (mbcType == 1) { if (addr < 0x2000) ramEnable = ((value & 0x0F) == 0x0A); else if (addr < 0x4000) { romBank = value & 0x1F; if (romBank == 0) romBank = 1; } else if (addr < 0x6000) ramBank = value & 0x03; else if (addr < 0x8000) bankingMode = value & 0x01; }
+            else if (mbcType == 2) { if (addr < 0x4000) { if (addr & 0x0100) { romBank = value & 0x0F; if (romBank == 0) romBank = 1; } else ramEnable = ((value & 0x0F) == 0x0A); } }
+            else if (mbcType == 3) { if (addr < 0x2000) ramEnable = ((value & 0x0F) == 0x0A); else if (addr < 0x4000) { romBank = value & 0x7F; if (romBank == 0) romBank = 1; } else if (addr < 0x6000) { ramBank = value; rtcMapped = (value >= 0x08 && value <= 0x0C); } else if (addr < 0x8000) rtcLatch = value; }
+            else if (mbcType == 4) { if (addr < 0x2000) ramEnable = ((value & 0x0F) == 0x0A); else if (addr < 0x4000) romBank = value & 0x3F; else if (addr < 0x6000) ramBank = value & 0x03; else if (addr < 0x8000) bankingMode = value & 0x01; }
+            else if (mbcType == 5) { if (addr < 0x2000) ramEnable = ((value & 0x0F) == 0x0A); else if (addr < 0x3000) romBank = (romBank & 0x100) | value; else if (addr < 0x4000) romBank = (romBank & 0x0FF) | ((value & 0x01) << 8); else if (addr < 0x6000) ramBank = value & 0x0F; }
+            if (ramBank != prevRamBank) probe.OnRamBankSwitch(); UpdateRomMap(); return;
+        }
+        if (addr < 0xA000) { vram[addr - 0x8000] = value; if (addr < 0x9800) DecodeTileRow((addr - 0x8000) >> 1); return; }
+        if (addr < 0xC000) {
+            if (ramEnable) {
+                if (mbcType == 3 && rtcMapped) {} else if (mbcType == 2) { size_t offset = (addr - 0xA000) & ramSizeMask; sram[offset] = value & 0x0F; MarkSramDirty(offset); }
+                else { if (ramSizeMask == 0) return; int bank = 0; if (mbcType == 1) bank = (bankingMode == 1) ? ramBank : 0; else if (mbcType == 3 || mbcType == 5 || mbcType == 4) bank = ramBank; size_t offset = ((bank * 0x2000) + (addr - 0xA000)) & ramSizeMask; sram[offset] = value; MarkSramDirty(offset); }
+            } return;
+        }
+        if (addr < 0xFE00) { int offset = (addr - 0xC000) & 0x1FFF; wram[offset] = value; InvalidateCode(0xC0 + (offset >> 8)); return; }
+        if (addr < 0xFEA0) { WriteOAM(addr - 0xFE00, value); return; } if (addr < 0xFF00) return;
+        if (sched && ((addr >= 0xFF04 && addr <= 0xFF07) || (addr >= 0xFF40 && addr <= 0xFF4B))) { bool timer = (addr <= 0xFF07); if (timer) sched->SyncTimers(); else sched->SyncPPU(); WriteIO(addr, value); if (timer) sched->SyncTimers(); else sched->SyncPPU(); return; }
+        WriteIO(addr, value);
+    }
+    void WriteIO(Word addr, Byte value) {
+        if (addr < 0xFF80 || addr == 0xFFFF) sideEffects++;
+        if (addr == 0xFF00) { io[0x00] = value; CheckJoypadInterrupt(); return; } if (addr == 0xFF04) { io[0x04] = 0; divCounter = 0; return; }
+        if (addr == 0xFF0F) { interruptFlag = value; return; } if (addr == 0xFF46) { DoDMA(value); return; }
+        if (addr == 0xFF41) { io[0x41] = (value & 0xF8) | (io[0x41] & 0x07); return; } if (addr == 0xFF44) { io[0x44] = 0; return; }
+        if (addr >= 0xFF10 && addr <= 0xFF3F) { if (apu) { if (sched) sched->SyncAPU(); apu->Write(addr, value); } return; }
+        if (addr < 0xFF80) { io[addr - 0xFF00] = value; return; } if (addr < 0xFFFF) { hram[addr - 0xFF80] = value; if (codeMarked[0xFF]) InvalidateCode(0xFF); return; }
+        if (addr == 0xFFFF) { interruptEnable = value; return; }
+    }
+    void SetKey(int keyId, bool pressed) { Byte* target = (keyId < 4) ? &joypadDir : &joypadButtons; int bit = keyId % 4; Byte oldVal = *target; if (pressed) *target &= ~(1 << bit); else *target |= (1 << bit); if (pressed && (oldVal & (1 << bit))) CheckJoypadInterrupt(); }
+    std::string GetTitle() { if (rom->size() < 0x143) return ""; char buf[17] = { 0 }; for (int i = 0; i < 16; i++) { char c = (*rom)[0x0134 + i]; if (c == 0) break; buf[i] = c; } return std::string(buf); }
+    std::string GetMBCName() { if (mbcType == 1) return "MBC1"; if (mbcType == 2) return "MBC2"; if (mbcType == 3) return "MBC3"; if (mbcType == 5) return "MBC5"; if (mbcType == 4) return "HuC1"; return "ROM ONLY"; }
+};
+static_assert(offsetof(MMU, sched) + sizeof(Scheduler*) - offsetof(MMU, interruptFlag) <= 64, "MMU hot scalars must share one cache line");
+class PPU {
+    MMU* mmu; uint32_t* screenBuffer; Byte* shadeBuffer; int cycleCounter, mode, windowLine, spriteCount; bool statIntSignal, renderEnabled; Byte lineSprites[10]; uint64_t drawnLines[3];
+    Byte latchSCX, latchSCY, latchBGP, latchOBP0, latchOBP1, latchLCDC, latchWY; int latchWX;
+    const uint32_t PALETTE[4] = { 0xFFE0F8D0, 0xFF88C070, 0xFF346856, 0xFF081820 };
+public:
+    PPU(MMU* m) : mmu(m), screenBuffer(nullptr), shadeBuffer(nullptr), cycleCounter(0), mode(2), windowLine(0), spriteCount(0), statIntSignal(false), renderEnabled(true), drawnLines() {}
+    void Reset() { cycleCounter = 0; mode = 2; windowLine = 0; spriteCount = 0; statIntSignal = false; if (mmu) mmu->io[0x41] = (mmu->io[0x41] & 0xFC) | 2; }
+    template <class S> void SerializeState(S& s) {
+        s.Value(cycleCounter); s.Value(mode); s.Value(windowLine); s.Value(statIntSignal); s.Value(latchSCX); s.Value(latchSCY);
+        s.Value(latchBGP); s.Value(latchOBP0); s.Value(latchOBP1); s.Value(latchLCDC); s.Value(latchWY); s.Value(latchWX); s.Value(spriteCount); s.Raw(lineSprites, sizeof(lineSprites));
+    }
+    void SetScreenBuffer(uint32_t* buffer) { screenBuffer = buffer; } void SetShadeBuffer(Byte* buffer) { shadeBuffer = buffer; } void SetRenderEnabled(bool enabled) { renderEnabled = enabled; }
+    Byte GetLY() { return mmu->io[0x44]; } void SetLY(Byte v) { mmu->io[0x44] = v; }
+    Byte GetLCDC() { return mmu->io[0x40]; } Byte GetSTAT() { return mmu->io[0x41]; } void SetSTAT(Byte v) { mmu->io[0x41] = v; }
+    Byte GetLYC() { return mmu->io[0x45]; }
+    void Step(int cycles) {
+        if (!(GetLCDC() & 0x80)) { SetLY(0); cycleCounter = 0; mode = 2; windowLine = 0; statIntSignal = false; SetSTAT(GetSTAT() & 0xFC); return; }
+        cycleCounter += cycles; Byte ly = GetLY(); Byte stat = GetSTAT(); bool lycMatch = (ly == GetLYC());
+        if (lycMatch) stat |= 0x04; else stat &= ~0x04;
+        if (mode == 2) {
+            if (cycleCounter >= 80) {
+                cycleCounter -= 80; mode = 3;
+                latchSCX = mmu->io[0x43]; latchSCY = mmu->io[0x42]; latchBGP = mmu->io[0x47];
+                latchOBP0 = mmu->io[0x48]; latchOBP1 = mmu->io[0x49]; latchLCDC = mmu->io[0x40];
+                latchWY = mmu->io[0x4A]; latchWX = (int)mmu->io[0x4B] - 7; SelectSprites(ly);
+            }
+        } else if (mode == 3) {
+            if (cycleCounter >= 172) { cycleCounter -= 172; mode = 0; RenderScanline(ly); }
+        } else if (mode == 0) {
+            if (cycleCounter >= 204) {
+                cycleCounter -= 204; ly++; SetLY(ly);
+                if (ly == 144) { mode = 1; mmu->RequestInterrupt(0); windowLine = 0; } else { mode = 2; }
+            }
+        } else if (mode == 1) {
+            if (cycleCounter >= 456) { cycleCounter -= 456; ly++; if (ly > 153) { mode = 2; ly = 0; windowLine = 0; } SetLY(ly); }
+        }
+        stat = (stat & 0xFC) | (mode & 0x03); SetSTAT(stat);
+        bool currentSignal = false;
+        if ((stat & 0x40) && lycMatch) currentSignal = true; if ((stat & 0x20) && (mode == 2)) currentSignal = true;
+        if ((stat & 0x10) && (mode == 1)) currentSignal = true; if ((stat & 0x08) && (mode == 0)) currentSignal = true;
+        if (currentSignal && !statIntSignal) mmu->RequestInterrupt(1); statIntSignal = currentSignal;
+    }
+    static void MapPalette(uint32_t* dst, const Byte* idx, int count, const uint32_t* pal) {
+        int x = 0;
+#ifdef GB_SSE2
+        const __m128i zero = _mm_setzero_si128(), p0 = _mm_set1_epi32((int)pal[0]), p1 = _mm_set1_epi32((int)pal[1]), p2 = _mm_set1_epi32((int)pal[2]), p3 = _mm_set1_epi32((int)pal[3]);
+        const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2), three = _mm_set1_epi32(3);
+        for (; x + 8 <= count; x += 8) {
+            __m128i i16 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(idx + x)), zero);
+            for (int half = 0; half < 2; half++) {
+                __m128i i32 = half ? _mm_unpackhi_epi16(i16, zero) : _mm_unpacklo_epi16(i16, zero);
+                __m128i c = _mm_and_si128(_mm_cmpeq_epi32(i32, zero), p0);
+                c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i32, one), p1)); c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i32, two), p2)); c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i32, three), p3));
+                _mm_storeu_si128((__m128i*)(dst + x + half * 4), c);
+            }
+        }
+#endif
+        for (; x < count; x++) dst[x] = pal[idx[x]];
+    }
+    void ExtractShades(Byte* dst, const uint32_t* src) const {
+        int x = 0;
+#ifdef GB_SSE2
+        const __m128i p1 = _mm_set1_epi32((int)PALETTE[1]), p2 = _mm_set1_epi32((int)PALETTE[2]), p3 = _mm_set1_epi32((int)PALETTE[3]);
+        auto Shade4 = [&](const uint32_t* p) { __m128i c = _mm_loadu_si128((const __m128i*)p); return _mm_sub_epi32(_mm_setzero_si128(), _mm_add_epi32(_mm_add_epi32(_mm_cmpeq_epi32(c, p1), _mm_slli_epi32(_mm_cmpeq_epi32(c, p2), 1)), _mm_add_epi32(_mm_cmpeq_epi32(c, p3), _mm_slli_epi32(_mm_cmpeq_epi32(c, p3), 1)))); };
+        for (; x + 16 <= 160; x += 16) _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(_mm_packs_epi32(Shade4(src + x), Shade4(src + x + 4)), _mm_packs_epi32(Shade4(src + x + 8), Shade4(src + x + 12))));
+#endif
+        for (; x < 160; x++) dst[x] = (Byte)((src[x] == PALETTE[1]) + (src[x] == PALETTE[2]) * 2 + (src[x] == PALETTE[3]) * 3);
+    }
+    void FetchTileSpan(Byte* out, Word mapAddr, int firstCol, int tiles, int row, bool unsignedTile) {
+        const Byte* map = mmu->vram.data() + (mapAddr - 0x8000);
+        for (int t = 0; t < tiles; t++) { Byte tileIdx = map[(firstCol + t) & 31]; int tile = unsignedTile ? tileIdx : 256 + static_cast<int8_t>(tileIdx); memcpy(out + t * 8, mmu->tileCache + tile * 64 + row * 8, 8); }
+    }
+    void SelectSprites(int line) {
+        spriteCount = 0; if (line >= 144 || !(latchLCDC & 0x02)) return; int height = (latchLCDC & 0x04) ? 16 : 8;
+        for (uint64_t rows = mmu->spriteRows[line]; rows && spriteCount < 10; rows &= rows - 1) { int i = LowestBit(rows); if (line - (mmu->oam[i * 4] - 16) < height) lineSprites[spriteCount++] = (Byte)i; }
+    }
+    void DrawSpriteSpan(uint32_t* dst, const Byte* idx, const Byte* bgIdx, Byte* taken, int first, int last, const uint32_t* pal, bool behindBg) {
+        int px = first;
+#ifdef GB_SSE2
+        if (first == 0 && last == 8) {
+            const __m128i zero = _mm_setzero_si128(); uint32_t colors[8]; MapPalette(colors, idx, 8, pal);
+            __m128i t = _mm_loadl_epi64((const __m128i*)taken), shown = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)idx), zero), _mm_cmpeq_epi8(t, _mm_set1_epi8(1))), _mm_set1_epi8(-1));
+            _mm_storel_epi64((__m128i*)taken, _mm_or_si128(t, _mm_and_si128(shown, _mm_set1_epi8(1)))); if (behindBg) shown = _mm_and_si128(shown, _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)bgIdx), zero));
+            __m128i shown16 = _mm_unpacklo_epi8(shown, shown);
+            for (int half = 0; half < 2; half++) {
+                __m128i mask = half ? _mm_unpackhi_epi16(shown16, shown16) : _mm_unpacklo_epi16(shown16, shown16); __m128i d = _mm_loadu_si128((const __m128i*)(dst + half * 4));
+                _mm_storeu_si128((__m128i*)(dst + half * 4), _mm_or_si128(_mm_andnot_si128(mask, d), _mm_and_si128(mask, _mm_loadu_si128((const __m128i*)(colors + half * 4)))));
+            }
+            return;
+        }
+#endif
+        for (; px < last; px++) { if (idx[px] == 0 || taken[px]) continue; taken[px] = 1; if (!(behindBg && bgIdx[px])) dst[px] = pal[idx[px]]; }
+    }
+    int NextEventCycles() {
+        if (!(GetLCDC() & 0x80)) return (GetLY() == 0 && cycleCounter == 0 && mode == 2 && windowLine == 0 && !statIntSignal && !(GetSTAT() & 0x03)) ? -1 : 1;
+        Byte stat = GetSTAT(); bool lycMatch = (GetLY() == GetLYC()); Byte next = ((lycMatch ? (stat | 0x04) : (stat & ~0x04)) & 0xFC) | (mode & 0x03);
+        bool signal = ((next & 0x40) && lycMatch) || ((next & 0x20) && mode == 2) || ((next & 0x10) && mode == 1) || ((next & 0x08) && mode == 0);
+        if (next != stat || signal != statIntSignal) return 1;
+        static const int MODE_CYCLES[4] = { 204, 456, 80, 172 }; int remaining = MODE_CYCLES[mode] - cycleCounter; return (remaining > 0) ? remaining : 1;
+    }
+    void BeginFrame() { memset(drawnLines, 0, sizeof(drawnLines)); }
+    void FinishFrame() {
+        if (!screenBuffer || !renderEnabled) return;
+        for (int line = 0; line < 144; line++) {
+            if (drawnLines[line >> 6] & (1ULL << (line & 63))) continue;
+            std::fill(screenBuffer + line * 160, screenBuffer + line * 160 + 160, PALETTE[0]); if (shadeBuffer) memset(shadeBuffer + line * 160, 0, 160);
+        }
+    }
+    void RenderScanline(int line) {
+        DrawScanline(line); if (!screenBuffer || !renderEnabled) return;
+        drawnLines[line >> 6] |= 1ULL << (line & 63); if (shadeBuffer) ExtractShades(shadeBuffer + line * 160, screenBuffer + line * 160);
+    }
+    void DrawBackground(uint32_t* out, Byte* lineIdx, int line, Byte lcdc) {
+        Byte scy = latchSCY, scx = latchSCX, bgp = latchBGP, wy = latchWY; int wx = latchWX;
+        uint32_t palette[4]; for (int i = 0; i < 4; i++) palette[i] = PALETTE[(bgp >> (i * 2)) & 3];
+        Word mapBase = (lcdc & 0x08) ? 0x9C00 : 0x9800; bool unsignedTile = (lcdc & 0x10);
+        Byte mapY = line + scy; Byte span[168];
+        FetchTileSpan(span, mapBase + (mapY / 8) * 32, scx / 8, 21, mapY % 8, unsignedTile); memcpy(lineIdx, span + (scx % 8), 160);
+        if ((lcdc & 0x20) && (line >= wy) && (wx <= 159)) {
+            Word winMapBase = (lcdc & 0x40) ? 0x9C00 : 0x9800; Byte winY = (Byte)windowLine;
+            int startX = (wx > 0) ? wx : 0; int winX = startX - wx; int count = 160 - startX;
+            FetchTileSpan(span, winMapBase + (winY / 8) * 32, winX / 8, (count + (winX % 8) + 7) / 8, winY % 8, unsignedTile); memcpy(lineIdx + startX, span + (winX % 8), count);
+            windowLine++;
+        }
+        MapPalette(out, lineIdx, 160, palette);
+    }
+    void DrawScanline(int line) {
+        if (!screenBuffer) return; Byte lcdc = latchLCDC;
+        if (!renderEnabled) { if ((lcdc & 0x21) == 0x21 && (line >= latchWY) && (latchWX <= 159)) windowLine++; return; }
+        Byte lineIdx[160]; uint32_t* out = screenBuffer + line * 160;
+        if (lcdc & 0x01) DrawBackground(out, lineIdx, line, lcdc); else { memset(lineIdx, 0, sizeof(lineIdx)); std::fill(out, out + 160, PALETTE[0]); }
+        if (!(lcdc & 0x02)) return;
+        Byte obp0 = latchOBP0, obp1 = latchOBP1; uint32_t palObj0[4], palObj1[4];
+        for (int i = 0; i < 4; i++) { palObj0[i] = PALETTE[(obp0 >> (i * 2)) & 3]; palObj1[i] = PALETTE[(obp1 >> (i * 2)) & 3]; }
+        int height = (lcdc & 0x04) ? 16 : 8; Byte order[10]; Byte taken[168] = {};
+        for (int k = 0; k < spriteCount; k++) { int j = k; Byte i = lineSprites[k]; for (; j > 0 && mmu->oam[order[j - 1] * 4 + 1] > mmu->oam[i * 4 + 1]; j--) order[j] = order[j - 1]; order[j] = i; }
+        for (int k = 0; k < spriteCount; k++) {
+            int i = order[k]; Byte y = mmu->oam[i * 4], x = mmu->oam[i * 4 + 1], tile = mmu->oam[i * 4 + 2], attr = mmu->oam[i * 4 + 3];
+            int spriteY = line - (y - 16); if (spriteY < 0 || spriteY >= height) continue;
+            if (attr & 0x40) spriteY = height - 1 - spriteY; if (height == 16) tile &= 0xFE;
+            int screenX = x - 8; if (screenX >= 160 || screenX <= -8) continue;
+            const Byte* row = mmu->tileCache + (tile * 8 + spriteY) * 8; Byte flipped[8]; if (attr & 0x20) { for (int px = 0; px < 8; px++) flipped[px] = row[7 - px]; row = flipped; }
+            int first = (screenX < 0) ? -screenX : 0, last = (screenX > 152) ? 160 - screenX : 8;
+            DrawSpriteSpan(out + screenX, row, lineIdx + screenX, taken + 8 + screenX, first, last, (attr & 0x10) ? palObj1 : palObj0, (attr & 0x80) != 0);
+        }
+    }
+};
+class CPU {
+public:
+    struct Registers {
+        struct { union { struct { Byte f; Byte a; }; Word af; }; } af; struct { union { struct { Byte c; Byte b; }; Word bc; }; } bc;
+        struct { union { struct { Byte e; Byte d; }; Word de; }; } de; struct { union { struct { Byte l; Byte h; }; Word hl; }; } hl;
+        Word sp, pc; bool ime; int imeDelay;
+    } reg;
+    using OpHandler = void (*)(CPU&);
+    struct DecodedOp { OpHandler handler; Byte opcode, length, operands[2], idleLoop; bool endsBlock; };
+    struct CodePage { uint32_t generation; DecodedOp ops[0x100]; };
+    static constexpr int MAX_BLOCK_OPS = 64, MAX_IDLE_OPS = 8; static constexpr Byte UNCACHEABLE = 0xFF, IDLE_UNKNOWN = 0, IDLE_NONE = 0xFF;
+    MMU* mmu; bool halted, haltBugTriggered; int currentCycles; const Byte* operandPtr; std::vector<std::unique_ptr<CodePage>> codePages; size_t codeRomSize; CodePage* codeMap[0x100]; int codeBank0, codeBank1;
+    CPU(MMU* m) : mmu(m), operandPtr(nullptr), codeRomSize(0) { Reset(); }
+    template <class S> void SerializeState(S& s) { s.Value(reg); s.Value(halted); s.Value(haltBugTriggered); }
+    void Reset() { reg.af.af = 0x01B0; reg.bc.bc = 0x0013; reg.de.de = 0x00D8; reg.hl.hl = 0x014D; reg.sp = 0xFFFE; reg.pc = 0x0100; reg.ime = false; reg.imeDelay = 0; halted = false; haltBugTriggered = false; currentCycles = 0; FlushCodeCache(); }
+    void FlushCodeCache() { codePages.clear(); codeRomSize = 0; codeBank0 = codeBank1 = -1; memset(codeMap, 0, sizeof(codeMap)); }
+    Byte Read(Word addr) { currentCycles += 4; return mmu->Read(addr); }
+    void Write(Word addr, Byte val) { currentCycles += 4; mmu->Write(addr, val); }
+    Byte Fetch() { if (operandPtr) { currentCycles += 4; mmu->probe.OnRead(reg.pc); reg.pc++; return *operandPtr++; } Byte val = Read(reg.pc); if (haltBugTriggered) haltBugTriggered = false; else reg.pc++; return val; }
+    Word Fetch16() { Byte l = Fetch(); Byte h = Fetch(); return (h << 8) | l; }
+    void Push(Word val) { reg.sp--; Write(reg.sp, val >> 8); reg.sp--; Write(reg.sp, val & 0xFF); }
+    Word Pop() { Byte l = Read(reg.sp++); Byte h = Read(reg.sp++); return (h << 8) | l; }
+    void F_Z(bool z) { if (z) reg.af.f |= 0x80; else reg.af.f &= ~0x80; } void F_N(bool n) { if (n) reg.af.f |= 0x40; else reg.af.f &= ~0x40; }
+    void F_H(bool h) { if (h) reg.af.f |= 0x20; else reg.af.f &= ~0x20; } void F_C(bool c) { if (c) reg.af.f |= 0x10; else reg.af.f &= ~0x10; }
+    bool IsZ() const { return reg.af.f & 0x80; } bool IsC() const { return reg.af.f & 0x10; }
+    template <int R> Byte& R8() {
+        static_assert(R != 6, "(HL) is a memory operand");
+        if constexpr (R == 0) return reg.bc.b; else if constexpr (R == 1) return reg.bc.c; else if constexpr (R == 2) return reg.de.d; else if constexpr (R == 3) return reg.de.e;
+        else if constexpr (R == 4) return reg.hl.h; else if constexpr (R == 5) return reg.hl.l; else return reg.af.a;
+    }
+    template <int R> Byte LoadR8() { if constexpr (R == 6) return Read(reg.hl.hl); else return R8<R>(); }
+    template <int R> void StoreR8(Byte val) { if constexpr (R == 6) Write(reg.hl.hl, val); else R8<R>() = val; }
+    template <int RR> Word& R16() { if constexpr (RR == 0) return reg.bc.bc; else if constexpr (RR == 1) return reg.de.de; else if constexpr (RR == 2) return reg.hl.hl; else return reg.sp; }
+    template <int CC> bool Cond() const { if constexpr (CC == 0) return !IsZ(); else if constexpr (CC == 1) return IsZ(); else if constexpr (CC == 2) return !IsC(); else return IsC(); }
+    void ALU_ADD(Byte v) { int r = reg.af.a + v; F_Z((r & 0xFF) == 0); F_N(0); F_H((reg.af.a & 0xF) + (v & 0xF) > 0xF); F_C(r > 0xFF); reg.af.a = (Byte)r; }
+    void ALU_ADC(Byte v) { int c = IsC() ? 1 : 0; int r = reg.af.a + v + c; F_Z((r & 0xFF) == 0); F_N(0); F_H((reg.af.a & 0xF) + (v & 0xF) + c > 0xF); F_C(r > 0xFF); reg.af.a = (Byte)r; }
+    void ALU_SUB(Byte v) { int r = reg.af.a - v; F_Z((r & 0xFF) == 0); F_N(1); F_H((reg.af.a & 0xF) < (v & 0xF)); F_C(reg.af.a < v); reg.af.a = (Byte)r; }
+    void ALU_SBC(Byte v) { int c = IsC() ? 1 : 0; int r = reg.af.a - v - c; F_Z((r & 0xFF) == 0); F_N(1); F_H((reg.af.a & 0xF) < (v & 0xF) + c); F_C(r < 0); reg.af.a = (Byte)r; }
+    void ALU_AND(Byte v) { reg.af.a &= v; F_Z(reg.af.a == 0); F_N(0); F_H(1); F_C(0); }
+    void ALU_XOR(Byte v) { reg.af.a ^= v; F_Z(reg.af.a == 0); F_N(0); F_H(0); F_C(0); }
+    void ALU_OR(Byte v) { reg.af.a |= v; F_Z(reg.af.a == 0); F_N(0); F_H(0); F_C(0); }
+    void ALU_CP(Byte v) { int r = reg.af.a - v; F_Z((r & 0xFF) == 0); F_N(1); F_H((reg.af.a & 0xF) < (v & 0xF)); F_C(reg.af.a < v); }
+    void ALU_INC(Byte& v) { v++; F_Z(v == 0); F_N(0); F_H((v & 0xF) == 0); }
+    void ALU_DEC(Byte& v) { v--; F_Z(v == 0); F_N(1); F_H((v & 0xF) == 0xF); }
+    void RLC(Byte& v) { int c = v >> 7; v = (v << 1) | c; F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void RRC(Byte& v) { int c = v & 1; v = (v >> 1) | (c << 7); F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void RL(Byte& v) { int c = v >> 7; v = (v << 1) | (IsC() ? 1 : 0); F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void RR(Byte& v) { int c = v & 1; v = (v >> 1) | (IsC() ? 0x80 : 0); F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void SLA(Byte& v) { int c = v >> 7; v <<= 1; F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void SRA(Byte& v) { int c = v & 1; v = (v >> 1) | (v & 0x80); F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void SWAP(Byte& v) { v = (v << 4) | (v >> 4); F_Z(v == 0); F_N(0); F_H(0); F_C(0); }
+    void SRL(Byte& v) { int c = v & 1; v >>= 1; F_Z(v == 0); F_N(0); F_H(0); F_C(c); }
+    void BIT(int b, Byte v) { F_Z(!(v & (1 << b))); F_N(0); F_H(1); }
+    template <int OP> void Alu(Byte v) {
+        if constexpr (OP == 0) ALU_ADD(v); else if constexpr (OP == 1) ALU_ADC(v); else if constexpr (OP == 2) ALU_SUB(v); else if constexpr (OP == 3) ALU_SBC(v);
+        else if constexpr (OP == 4) ALU_AND(v); else if constexpr (OP == 5) ALU_XOR(v); else if constexpr (OP == 6) ALU_OR(v); else ALU_CP(v);
+    }
+    template <int OP> void Shift(Byte& v) {
+        if constexpr (OP == 0) RLC(v); else if constexpr (OP == 1) RRC(v); else if constexpr (OP == 2) RL(v); else if constexpr (OP == 3) RR(v);
+        else if constexpr (OP == 4) SLA(v); else if constexpr (OP == 5) SRA(v); else if constexpr (OP == 6) SWAP(v); else SRL(v);
+    }
+    void AddHL(Word v) { Word hl = reg.hl.hl; int r = hl + v; F_N(0); F_H((hl & 0xFFF) + (v & 0xFFF) > 0xFFF); F_C(r > 0xFFFF); reg.hl.hl = (Word)r; }
+    Word AddSPImm() { SignedByte r = (SignedByte)Fetch(); Word sp = reg.sp; F_Z(0); F_N(0); F_H((sp & 0xF) + (r & 0xF) > 0xF); F_C((sp & 0xFF) + (r & 0xFF) > 0xFF); return (Word)(sp + r); }
+    template <int OP> static void Exec(CPU& c) {
+        constexpr int X = OP >> 6, Y = (OP >> 3) & 7, Z = OP & 7, P = Y >> 1, Q = Y & 1;
+        if constexpr (OP == 0x76) c.halted = true;
+        else if constexpr (X == 1) c.StoreR8<Y>(c.LoadR8<Z>());
+        else if constexpr (X == 2) c.Alu<Y>(c.LoadR8<Z>());
+        else if constexpr (X == 0 && Z == 4) { Byte v = c.LoadR8<Y>(); c.ALU_INC(v); c.StoreR8<Y>(v); }
+        else if constexpr (X == 0 && Z == 5) { Byte v = c.LoadR8<Y>(); c.ALU_DEC(v); c.StoreR8<Y>(v); }
+        else if constexpr (X == 0 && Z == 6) c.StoreR8<Y>(c.Fetch());
+        else if constexpr (X == 0 && Z == 1 && Q == 0) c.R16<P>() = c.Fetch16();
+        else if constexpr (X == 0 && Z == 1 && Q == 1) c.AddHL(c.R16<P>());
+        else if constexpr (X == 0 && Z == 3 && Q == 0) c.R16<P>()++;
+        else if constexpr (X == 0 && Z == 3 && Q == 1) c.R16<P>()--;
+        else if constexpr (X == 0 && Z == 0 && Y >= 4) { SignedByte r = (SignedByte)c.Fetch(); if (c.Cond<Y - 4>()) c.reg.pc += r; }
+        else if constexpr (X == 3 && Z == 0 && Y < 4) { if (c.Cond<Y>()) c.reg.pc = c.Pop(); else c.currentCycles -= 4; }
+        else if constexpr (X == 3 && Z == 2 && Y < 4) { Word a = c.Fetch16(); if (c.Cond<Y>()) c.reg.pc = a; }
+        else if constexpr (X == 3 && Z == 4 && Y < 4) { Word a = c.Fetch16(); if (c.Cond<Y>()) c.Push(c.reg.pc), c.reg.pc = a; }
+        else if constexpr (X == 3 && Z == 1 && Q == 0) { if constexpr (P == 3) { c.reg.af.af = c.Pop(); c.reg.af.f &= 0xF0; } else c.R16<P>() = c.Pop(); }
+        else if constexpr (X == 3 && Z == 5 && Q == 0) c.Push((P == 3) ? c.reg.af.af : c.R16<P>());
+        else if constexpr (X == 3 && Z == 6) c.Alu<Y>(c.Fetch());
+        else if constexpr (X == 3 && Z == 7) { c.Push(c.reg.pc); c.reg.pc = Y * 8; }
+        else if constexpr (OP == 0x02) c.Write(c.reg.bc.bc, c.reg.af.a); else if constexpr (OP == 0x12) c.Write(c.reg.de.de, c.reg.af.a);
+        else if constexpr (OP == 0x22) c.Write(c.reg.hl.hl++, c.reg.af.a); else if constexpr (OP == 0x32) c.Write(c.reg.hl.hl--, c.reg.af.a);
+        else if constexpr (OP == 0x0A) c.reg.af.a = c.Read(c.reg.bc.bc); else if constexpr (OP == 0x1A) c.reg.af.a = c.Read(c.reg.de.de);
+        else if constexpr (OP == 0x2A) c.reg.af.a = c.Read(c.reg.hl.hl++); else if constexpr (OP == 0x3A) c.reg.af.a = c.Read(c.reg.hl.hl--);
+        else if constexpr (OP == 0x07) { c.RLC(c.reg.af.a); c.F_Z(0); } else if constexpr (OP == 0x0F) { c.RRC(c.reg.af.a); c.F_Z(0); }
+        else if constexpr (OP == 0x17) { c.RL(c.reg.af.a); c.F_Z(0); } else if constexpr (OP == 0x1F) { c.RR(c.reg.af.a); c.F_Z(0); }
+        else if constexpr (OP == 0x08) { Word a = c.Fetch16(); c.Write(a, c.reg.sp & 0xFF); c.Write(a + 1, c.reg.sp >> 8); }
+        else if constexpr (OP == 0x10) { c.Fetch(); c.halted = true; }
+        else if constexpr (OP == 0x18) { SignedByte r = (SignedByte)c.Fetch(); c.reg.pc += r; }
+        else if constexpr (OP == 0x27) { int a = c.reg.af.a; if (!(c.reg.af.f & 0x40)) { if ((c.reg.af.f & 0x10) || a > 0x99) { a += 0x60; c.F_C(1); } if ((c.reg.af.f & 0x20) || (a & 0xF) > 9) a += 6; } else { if (c.reg.af.f & 0x10) a -= 0x60; if (c.reg.af.f & 0x20) a -= 6; } c.F_Z((a & 0xFF) == 0); c.F_H(0); c.reg.af.a = a; }
+        else if constexpr (OP == 0x2F) { c.reg.af.a ^= 0xFF; c.F_N(1); c.F_H(1); } else if constexpr (OP == 0x37) { c.F_N(0); c.F_H(0); c.F_C(1); } else if constexpr (OP == 0x3F) { c.F_N(0); c.F_H(0); c.F_C(!c.IsC()); }
+        else if constexpr (OP == 0xC3) c.reg.pc = c.Fetch16(); else if constexpr (OP == 0xC9) c.reg.pc = c.Pop(); else if constexpr (OP == 0xD9) { c.reg.pc = c.Pop(); c.reg.imeDelay = 2; }
+        else if constexpr (OP == 0xCD) { Word a = c.Fetch16(); c.Push(c.reg.pc); c.reg.pc = a; }
+        else if constexpr (OP == 0xCB) { Byte op = c.Fetch(); c.mmu->probe.OnCBOpcode(op); CB_OPCODES[op](c); }
+        else if constexpr (OP == 0xE0) c.Write(0xFF00 | c.Fetch(), c.reg.af.a); else if constexpr (OP == 0xE2) c.Write(0xFF00 | c.reg.bc.c, c.reg.af.a);
+        else if constexpr (OP == 0xF0) c.reg.af.a = c.Read(0xFF00 | c.Fetch()); else if constexpr (OP == 0xF2) c.reg.af.a = c.Read(0xFF00 | c.reg.bc.c);
+        else if constexpr (OP == 0xEA) c.Write(c.Fetch16(), c.reg.af.a); else if constexpr (OP == 0xFA) c.reg.af.a = c.Read(c.Fetch16());
+        else if constexpr (OP == 0xE8) c.reg.sp = c.AddSPImm(); else if constexpr (OP == 0xF8) c.reg.hl.hl = c.AddSPImm();
+        else if constexpr (OP == 0xE9) c.reg.pc = c.reg.hl.hl; else if constexpr (OP == 0xF9) c.reg.sp = c.reg.hl.hl;
+        else if constexpr (OP == 0xF3) c.reg.ime = false; else if constexpr (OP == 0xFB) c.reg.imeDelay = 2;
+    }
+    template <int OP> static void ExecCBOp(CPU& c) {
+        constexpr int Y = (OP >> 3) & 7, Z = OP & 7; Byte val = c.LoadR8<Z>();
+        if constexpr (OP < 0x40) { c.Shift<Y>(val); c.StoreR8<Z>(val); }
+        else if constexpr (OP < 0x80) c.BIT(Y, val);
+        else if constexpr (OP < 0xC0) { val &= ~(1 << Y); c.StoreR8<Z>(val); }
+        else { val |= (1 << Y); c.StoreR8<Z>(val); }
+    }
+    template <int... OPS> static constexpr std::array<OpHandler, 256> MakeOpcodeTable(std::integer_sequence<int, OPS...>) { return { { &Exec<OPS>... } }; }
+    template <int... OPS> static constexpr std::array<OpHandler, 256> MakeCBOpcodeTable(std::integer_sequence<int, OPS...>) { return { { &ExecCBOp<OPS>... } }; }
+    static const std::array<OpHandler, 256> OPCODES, CB_OPCODES;
+    static constexpr int OpcodeLength(int op) {
+        return (op == 0x01 || op == 0x11 || op == 0x21 || op == 0x31 || op == 0x08 || op == 0xC3 || op == 0xCD || op == 0xEA || op == 0xFA || ((op & 0xE7) == 0xC2) || ((op & 0xE7) == 0xC4)) ? 3
+            : (((op & 0xC7) == 0x06) || ((op & 0xC7) == 0xC6) || op == 0x10 || op == 0x18 || ((op & 0xE7) == 0x20) || op == 0xCB || op == 0xE0 || op == 0xF0 || op == 0xE8 || op == 0xF8) ? 2 : 1;
+    }
+    static constexpr bool EndsBlock(int op) {
+        return op == 0x10 || op == 0x18 || ((op & 0xE7) == 0x20) || op == 0x76 || ((op & 0xE7) == 0xC0) || ((op & 0xE7) == 0xC2) || ((op & 0xE7) == 0xC4) || ((op & 0xC7) == 0xC7)
+            || op == 0xC3 || op == 0xC9 || op == 0xCD || op == 0xD9 || op == 0xE9 || op == 0xFB;
+    }
+    DecodedOp* CodeSlot(Word pc, Word& regionEnd, const Byte*& bytes) {
+        size_t index; int busPage = pc >> 8;
+        if (pc < 0x8000) { size_t bank = (pc < 0x4000) ? mmu->mappedBank0 : mmu->mappedBank1; index = bank * 0x4000 + (pc & 0x3FFF); regionEnd = (pc < 0x4000) ? 0x4000 : 0x8000; bytes = mmu->rom->data() + index; }
+        else if (pc >= 0xC000 && pc < 0xE000) { index = codeRomSize + (pc - 0xC000); regionEnd = 0xE000; bytes = mmu->wram.data() + (pc - 0xC000); }
+        else if (pc >= 0xFF80 && pc < 0xFFFF) { index = codeRomSize + 0x2000 + (pc - 0xFF80); regionEnd = 0xFFFF; bytes = mmu->hram.data() + (pc - 0xFF80); }
+        else return nullptr;
+        std::unique_ptr<CodePage>& page = codePages[index >> 8];
+        if (!page) { page.reset(new CodePage()); memset(page->ops, 0, sizeof(page->ops)); page->generation = mmu->codeGeneration[busPage]; if (pc < 0xE000) codeMap[busPage] = page.get(); }
+        else if (pc >= 0x8000 && page->generation != mmu->codeGeneration[busPage]) { memset(page->ops, 0, sizeof(page->ops)); page->generation = mmu->codeGeneration[busPage]; }
+        return &page->ops[index & 0xFF];
+    }
+    void DecodeBlock(Word pc) {
+        for (int n = 0; n < MAX_BLOCK_OPS; n++) {
+            Word regionEnd; const Byte* bytes; DecodedOp* d = CodeSlot(pc, regionEnd, bytes); if (!d || (n > 0 && d->length)) return;
+            Byte op = bytes[0]; int length = OpcodeLength(op); if (pc + length > regionEnd) { d->handler = nullptr; d->length = UNCACHEABLE; return; }
+            d->handler = OPCODES[op]; d->opcode = op; d->length = (Byte)length; d->operands[0] = (length > 1) ? bytes[1] : 0; d->operands[1] = (length > 2) ? bytes[2] : 0; d->idleLoop = IDLE_UNKNOWN; d->endsBlock = EndsBlock(op);
+            if (pc >= 0x8000) { mmu->MarkCode(pc >> 8); mmu->MarkCode((pc + length - 1) >> 8); }
+            if (EndsBlock(op)) return; pc += length;
+        }
+    }
+    void RemapCode() {
+        size_t romSize = (size_t)mmu->romBankCount * 0x4000;
+        if (codeRomSize != romSize) { FlushCodeCache(); codePages.resize((romSize + 0x2100) >> 8); codeRomSize = romSize; for (int page = 0xC0; page < 0xE0; page++) codeMap[page] = nullptr; }
+        codeBank0 = mmu->mappedBank0; codeBank1 = mmu->mappedBank1;
+        for (int page = 0; page < 0x80; page++) codeMap[page] = codePages[(((page < 0x40) ? codeBank0 : codeBank1) * 0x4000 + ((page & 0x3F) << 8)) >> 8].get();
+    }
+    static bool IsIdleSafe(const DecodedOp& op) {
+        Byte o = op.opcode; Word addr;
+        if (o == 0x00 || o == 0xA7 || o == 0xB7 || o == 0xBF || o == 0xE6 || o == 0xEE || o == 0xF6 || o == 0xFE) return true;
+        if (o == 0xCB) return (op.operands[0] & 0xC7) == 0x47;
+        if (o == 0xF0) addr = 0xFF00 | op.operands[0]; else if (o == 0xFA) addr = op.operands[0] | (op.operands[1] << 8); else return false;
+        return (addr >= 0xC000 && addr < 0xE000) || addr >= 0xFF80 || addr == 0xFF0F || addr == 0xFF41 || addr == 0xFF44;
+    }
+    Byte ClassifyIdleLoop(Word pc) {
+        CodePage* page = codeMap[pc >> 8]; if (!page) return IDLE_NONE; Word at = pc;
+        for (int n = 0; n < MAX_IDLE_OPS && (at >> 8) == (pc >> 8); n++) {
+            const DecodedOp& op = page->ops[at & 0xFF]; if (!op.handler) return IDLE_NONE; Word next = at + op.length, target;
+            if (!op.endsBlock) { if (!IsIdleSafe(op)) return IDLE_NONE; at = next; continue; }
+            if (op.opcode == 0x18 || (op.opcode & 0xE7) == 0x20) target = next + (SignedByte)op.operands[0];
+            else if (op.opcode == 0xC3 || (op.opcode & 0xE7) == 0xC2) target = op.operands[0] | (op.operands[1] << 8); else return IDLE_NONE;
+            return (target == pc) ? (Byte)(next - pc) : IDLE_NONE;
+        } return IDLE_NONE;
+    }
+    DecodedOp* LookupCode(Word pc) {
+        if (codeBank0 != mmu->mappedBank0 || codeBank1 != mmu->mappedBank1 || codeRomSize != (size_t)mmu->romBankCount * 0x4000) RemapCode();
+        CodePage* page = codeMap[pc >> 8]; DecodedOp* d;
+        if (page) { if (pc >= 0x8000 && page->generation != mmu->codeGeneration[pc >> 8]) { memset(page->ops, 0, sizeof(page->ops)); page->generation = mmu->codeGeneration[pc >> 8]; } d = &page->ops[pc & 0xFF]; }
+        else { Word regionEnd; const Byte* bytes; d = CodeSlot(pc, regionEnd, bytes); if (!d) return nullptr; }
+        if (!d->length) DecodeBlock(pc); return d->handler ? d : nullptr;
+    }
+    bool HandleInterrupts() {
+        if (reg.ime && (mmu->interruptFlag & mmu->interruptEnable)) {
+            Byte fired = mmu->interruptFlag & mmu->interruptEnable; int bit = 0;
+            if (fired & 0x01) bit = 0; else if (fired & 0x02) bit = 1; else if (fired & 0x04) bit = 2; else if (fired & 0x08) bit = 3; else if (fired & 0x10) bit = 4; else return false;
+            reg.ime = false; mmu->interruptFlag &= ~(1 << bit); Push(reg.pc); reg.pc = 0x0040 + (bit * 8); currentCycles += 20; halted = false; return true;
+        } return false;
+    }
+    void Run(Scheduler& s, uint64_t frameEnd) {
+        Word loopPc = 0, loopAF = 0; Byte loopBytes = 0; uint64_t loopAt = 0;
+        while (s.now < s.nextEvent && s.now < frameEnd) {
+            uint64_t limit = (std::min)(s.nextEvent, frameEnd);
+            if (halted && !reg.imeDelay && !(mmu->interruptFlag & mmu->interruptEnable)) { currentCycles = 4; s.now += (limit - s.now + 3) & ~3ULL; continue; }
+            if (reg.imeDelay || halted || haltBugTriggered || (reg.ime && (mmu->interruptFlag & mmu->interruptEnable))) { loopBytes = 0; s.now += Step(); continue; }
+            DecodedOp* d = LookupCode(reg.pc); if (!d) { loopBytes = 0; s.now += Step(); continue; }
+            if (!Probe::ENABLED) {
+                if ((Word)(reg.pc - loopPc) >= loopBytes) loopBytes = 0; if (d->idleLoop == IDLE_UNKNOWN) d->idleLoop = ClassifyIdleLoop(reg.pc);
+                if (d->idleLoop != IDLE_NONE) {
+                    if (loopBytes && loopPc == reg.pc && loopAF == reg.af.af) { uint64_t period = s.now - loopAt; s.now += (limit - s.now - 1) / period * period; }
+                    loopPc = reg.pc; loopAF = reg.af.af; loopBytes = d->idleLoop; loopAt = s.now;
+                }
+            }
+            uint32_t effects = mmu->sideEffects;
+            while (true) {
+                mmu->probe.OnExec(reg.pc < 0x4000 ? mmu->mappedBank0 : mmu->mappedBank1, reg.pc); currentCycles = 4; mmu->probe.OnRead(reg.pc); reg.pc++; mmu->probe.OnOpcode(d->opcode);
+                operandPtr = d->operands; d->handler(*this); operandPtr = nullptr; s.now += currentCycles;
+                if (d->endsBlock || effects != mmu->sideEffects || s.now >= limit) break;
+                CodePage* page = codeMap[reg.pc >> 8]; if (!page || (reg.pc >= 0x8000 && page->generation != mmu->codeGeneration[reg.pc >> 8])) break;
+                d = &page->ops[reg.pc & 0xFF]; if (!d->handler) break;
+            }
+        }
+    }
+    int Step() {
+        if (reg.imeDelay > 0) { reg.imeDelay--; if (reg.imeDelay == 0) reg.ime = true; }
+        if (HandleInterrupts()) return currentCycles;
+        if (halted) { currentCycles = 4; if (mmu->interruptFlag & mmu->interruptEnable) { halted = false; if (!reg.ime) haltBugTriggered = true; } return currentCycles; }
+        currentCycles = 0; mmu->probe.OnExec(reg.pc < 0x4000 ? mmu->mappedBank0 : mmu->mappedBank1, reg.pc);
+        if (!haltBugTriggered) {
+            const DecodedOp* d = LookupCode(reg.pc);
+            if (d) { currentCycles = 4; mmu->probe.OnRead(reg.pc); reg.pc++; mmu->probe.OnOpcode(d->opcode); operandPtr = d->operands; d->handler(*this); operandPtr = nullptr; return currentCycles; }
+        }
+        Byte op = Fetch(); mmu->probe.OnOpcode(op);
+        OPCODES[op](*this);
+        return currentCycles;
+    }
+};
+inline const std::array<CPU::OpHandler, 256> CPU::OPCODES = CPU::MakeOpcodeTable(std::make_integer_sequence<int, 256>());
+inline const std::array<CPU::OpHandler, 256> CPU::CB_OPCODES = CPU::MakeCBOpcodeTable(std::make_integer_sequence<int, 256>());
+inline void Scheduler::SyncPPU() { GB_PROFILE_SCOPE(profileNs[PROF_PPU]); if (now > ppuSync) { ppu->Step((int)(now - ppuSync)); ppuSync = now; } int next = ppu->NextEventCycles(); Schedule(EVT_PPU, (next < 0) ? NEVER : now + next); }
+inline void Scheduler::SyncTimers() { GB_PROFILE_SCOPE(profileNs[PROF_TIMERS]); if (now > timerSync) { mmu->UpdateTimers((int)(now - timerSync)); timerSync = now; } int next = mmu->CyclesUntilTimerOverflow(); Schedule(EVT_TIMER, (next < 0) ? NEVER : now + next); }
+inline void Scheduler::SyncAPU() { GB_PROFILE_SCOPE(profileNs[PROF_APU]); if (now > apuSync) { apu->Step((int)(now - apuSync)); apuSync = now; } }
+inline void Scheduler::SyncAll() { SyncPPU(); SyncTimers(); SyncAPU(); }
+inline void Scheduler::RunDueEvents() {
+    if (when[EVT_PPU] <= now) SyncPPU();
+    if (when[EVT_RTC] <= now) { GB_PROFILE_SCOPE(profileNs[PROF_TIMERS]); mmu->UpdateRTC(); Schedule(EVT_RTC, (mmu->mbcType == 3) ? now + RTC_POLL_CYCLES : NEVER); }
+    if (when[EVT_TIMER] <= now) SyncTimers();
+}
+inline time_t MMU::ClockNow() const { return (emulatedClock && sched) ? (time_t)(sched->now / 4194304) : time(NULL); }
+class GameBoyCore {
+    struct StateHeader { uint32_t magic, version, size, romSize; Word romChecksum; };
+    static constexpr uint32_t STATE_MAGIC = 0x53534247, STATE_VERSION = 2;
+    template <class S> void SerializeState(S& s) { cpu.SerializeState(s); mmu.SerializeState(s); ppu.SerializeState(s); apu.SerializeState(s); sched.SerializeState(s); s.Raw(displayBuffer.data(), displayBuffer.size() * sizeof(uint32_t)); }
+    template <class S> void SerializeSnapshot(S& s) { cpu.SerializeState(s); mmu.SerializeState(s); ppu.SerializeState(s); apu.SerializeState(s); sched.SerializeState(s); s.Value(mmu.lastTime); s.Raw(mmu.tileCache, sizeof(mmu.tileCache)); s.Raw(mmu.spriteRows, sizeof(mmu.spriteRows)); }
+    StateHeader MakeStateHeader() { StateHeader h = { STATE_MAGIC, STATE_VERSION, 0, (uint32_t)mmu.rom->size(), (Word)(((*mmu.rom)[0x014E] << 8) | (*mmu.rom)[0x014F]) }; StateWriter sizer(nullptr, 0); sizer.Value(h); SerializeState(sizer); h.size = (uint32_t)sizer.Size(); return h; }
+public:
+    MMU mmu; CPU cpu; PPU ppu; APU apu; Scheduler sched; std::vector<uint32_t> displayBuffer; bool isRomLoaded; std::wstring m_savePath;
+    GameBoyCore() : cpu(&mmu), ppu(&mmu), isRomLoaded(false) {
+        displayBuffer.resize(GB_WIDTH * GB_HEIGHT); ppu.SetScreenBuffer(displayBuffer.data()); mmu.SetAPU(&apu); mmu.SetScheduler(&sched);
+        sched.ppu = &ppu; sched.mmu = &mmu; sched.apu = &apu; Reset(false);
+    }
+    void Reset(bool loaded) { sched.Reset(); mmu.Reset(); cpu.Reset(); ppu.Reset(); apu.Reset(); isRomLoaded = loaded; if (!isRomLoaded) SetupTestRender(); else { mmu.io[0x40] = 0x91; mmu.io[0x47] = 0xE4; } }
+    void SetupTestRender() {
+        static const std::shared_ptr<const RomImage> testImage = [] { std::vector<Byte> bytes(0x8000, 0); bytes[0x0101] = 0xC3; bytes[0x0103] = 0x01; return RomImage::FromBytes(std::move(bytes)); }(); mmu.rom = testImage; mmu.UpdateMemoryMap(); mmu.io[0x40] = 0x91; mmu.io[0x47] = 0xE4;
+        for (int i = 0; i < 0x1800; i++) mmu.vram[i] = (i % 2 == 0) ? 0xFF : 0x00; mmu.DecodeAllTiles();
+    }
+    bool LoadRom(const std::wstring& path) { return LoadRom(path, RomImage::Open(path)); }
+    bool LoadRom(const std::wstring& path, std::shared_ptr<const RomImage> image) {
+        if (!image) return false; LoadRomImage(std::move(image)); m_savePath = path;
+        size_t dotPos = m_savePath.find_last_of(L'.'); if (dotPos != std::string::npos) m_savePath = m_savePath.substr(0, dotPos); m_savePath += L".sav"; mmu.LoadRAM(m_savePath); return true;
+    }
+    void LoadRomImage(std::shared_ptr<const RomImage> image) { Reset(true); mmu.LoadRomData(std::move(image)); m_savePath.clear(); }
+    void LoadRomImage(const std::vector<Byte>& data) { LoadRomImage(RomImage::FromBytes(data)); }
+    void SetEmulatedClock(bool enabled) { mmu.emulatedClock = enabled; mmu.lastTime = mmu.ClockNow(); }
+    void SaveRAM() { if (isRomLoaded && !m_savePath.empty()) mmu.SaveRAM(m_savePath); }
+    bool CaptureSave(std::vector<Byte>& image, bool full) { return isRomLoaded && !m_savePath.empty() && mmu.CollectSave(image, full); }
+    std::string GetTitle() { return mmu.GetTitle() + " (" + mmu.GetMBCName() + ")"; }
+    void StepFrame(bool produceOutput = true) { StepFrame(produceOutput, produceOutput); }
+    void StepFrame(bool renderVideo, bool produceAudio) {
+        ppu.SetRenderEnabled(renderVideo); ppu.BeginFrame(); apu.SetMuted(!produceAudio); GB_PROFILE_SCOPE(sched.profileNs[Scheduler::PROF_FRAME]); const int CYCLES_PER_FRAME = 70224; uint64_t frameEnd = sched.now + CYCLES_PER_FRAME;
+        while (sched.now < frameEnd) {
+            cpu.Run(sched, frameEnd);
+            sched.RunDueEvents();
+        }
+        sched.SyncAll(); ppu.FinishFrame(); { GB_PROFILE_SCOPE(sched.profileNs[Scheduler::PROF_APU]); apu.EndFrame(); }
+    }
+    const void* GetPixelData() const { return displayBuffer.data(); }
+    void SetFrameTargets(uint32_t* pixels, Byte* shades) { ppu.SetScreenBuffer(pixels ? pixels : displayBuffer.data()); ppu.SetShadeBuffer(shades); }
+    void SwapDisplayBuffer(std::vector<uint32_t>& pixels) { pixels.resize(GB_WIDTH * GB_HEIGHT); displayBuffer.swap(pixels); ppu.SetScreenBuffer(displayBuffer.data()); }
+    void InputKey(int key, bool pressed) { mmu.SetKey(key, pressed); }
+    AudioRing& GetAudioSamples() { return apu.buffer; }
+    void SetAudioRate(double ratio) { apu.SetRateAdjust(ratio); }
+    bool WriteInstrumentationReport(const std::wstring& path) { if (!Probe::ENABLED) return false; FILE* fp = OpenFile(path, L"w"); if (!fp) return false; mmu.probe.Report(fp); fclose(fp); return true; }
+    size_t SaveStateSize() { return MakeStateHeader().size; }
+    bool SaveState(void* buffer, size_t capacity) { StateHeader h = MakeStateHeader(); if (!buffer || capacity < h.size) return false; StateWriter w(buffer, capacity); w.Value(h); SerializeState(w); return w.Ok(); }
+    void SaveSnapshot(std::vector<Byte>& out) { StateWriter sizer(nullptr, 0); SerializeSnapshot(sizer); out.resize(sizer.Size()); StateWriter w(out.data(), out.size()); SerializeSnapshot(w); }
+    bool RestoreSnapshot(const std::vector<Byte>& in) { StateReader r(in.data(), in.size()); SerializeSnapshot(r); mmu.UpdateMemoryMap(); return r.Ok(); }
+    bool LoadState(const void* buffer, size_t size) {
+        StateHeader expected = MakeStateHeader(), h; if (!buffer || size < sizeof(StateHeader)) return false; memcpy(&h, buffer, sizeof(StateHeader));
+        if (h.magic != expected.magic || h.version != expected.version || h.romSize != expected.romSize || h.romChecksum != expected.romChecksum || h.size != expected.size || size < h.size) return false;
+        StateReader r(buffer, size); r.Value(h); SerializeState(r); mmu.UpdateMemoryMap(); mmu.DecodeAllTiles(); mmu.IndexAllSprites(); memset(mmu.sramDirty, 0xFF, sizeof(mmu.sramDirty)); return r.Ok();
+    }
+};
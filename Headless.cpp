@@ -0,0 +1,146 @@
+﻿// g++ -O2 -std=c++17 -pthread Headless.cpp -o gbheadless   (-l N runs the threaded runner for N seconds with a dummy video consumer and a clocked audio sink, -k skews its clock in ppm and -w writes its PCM; -R/-m record and verify an input movie; -A N benchmarks N frames of run-ahead; -c/-a capture video and WAV, -b captures the synthetic LCD-off ROM)
+#include "GameBoyCore.h"
+#include "WorkStealingPool.h"
+#include "CoreRunner.h"
+#include "Movie.h"
+#include "Capture.h"
+#include "SyntheticRoms.h"
+#include "AudioSink.h"
+#include <chrono>
+#include <clocale>
+#include <memory>
+struct HeadlessOptions { int instances = 64, frames = 600, threads = 0, slice = 30, captureScale = 1, runAhead = 0; bool lcdOffRom = false; double latencySeconds = 0, audioSkewPpm = 0; std::wstring romPath, recordPath, replayPath, videoPath, wavPath, pcmPath; };
+static std::wstring ToWide(const char* s) { std::wstring w(strlen(s) + 1, L'\0'); size_t len = mbstowcs(&w[0], s, w.size()); if (len == (size_t)-1) return std::wstring(s, s + strlen(s)); w.resize(len); return w; }
+static bool ParseArgs(int argc, char** argv, HeadlessOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i]; bool hasValue = (i + 1 < argc);
+        if (arg == "-n" && hasValue) opt.instances = atoi(argv[++i]); else if (arg == "-f" && hasValue) opt.frames = atoi(argv[++i]);
+        else if (arg == "-t" && hasValue) opt.threads = atoi(argv[++i]); else if (arg == "-s" && hasValue) opt.slice = atoi(argv[++i]);
+        else if (arg == "-l" && hasValue) opt.latencySeconds = atof(argv[++i]); else if (arg == "-k" && hasValue) opt.audioSkewPpm = atof(argv[++i]);
+        else if (arg == "-A" && hasValue) opt.runAhead = atoi(argv[++i]); else if (arg == "-w" && hasValue) opt.pcmPath = ToWide(argv[++i]);
+        else if (arg == "-R" && hasValue) opt.recordPath = ToWide(argv[++i]); else if (arg == "-m" && hasValue) opt.replayPath = ToWide(argv[++i]);
+        else if (arg == "-c" && hasValue) opt.videoPath = ToWide(argv[++i]); else if (arg == "-a" && hasValue) opt.wavPath = ToWide(argv[++i]);
+        else if (arg == "-x" && hasValue) opt.captureScale = atoi(argv[++i]); else if (arg == "-b") opt.lcdOffRom = true;
+        else if (arg[0] == '-') return false; else opt.romPath = ToWide(argv[i]);
+    }
+    return opt.instances > 0 && opt.frames > 0 && opt.slice > 0 && opt.captureScale > 0 && opt.runAhead >= 0 && opt.runAhead <= CoreRunner::MAX_RUN_AHEAD;
+}
+static void Percentiles(std::vector<double>& v, double& mean, double& p50, double& p99, double& worst) {
+    mean = p50 = p99 = worst = 0; if (v.empty()) return; std::sort(v.begin(), v.end());
+    for (double x : v) mean += x; mean /= v.size(); p50 = v[v.size() / 2]; p99 = v[(v.size() * 99) / 100]; worst = v.back();
+}
+static int RunLatencyTest(const HeadlessOptions& opt) {
+    GameBoyCore core; if (!opt.romPath.empty() && !core.LoadRom(opt.romPath)) { fprintf(stderr, "failed to load ROM\n"); return 1; }
+    CoreRunner runner(core); std::atomic<bool> done(false); std::vector<double> latencyMs, presentIntervalMs, audioQueuedMs; uint64_t presented = 0, repeated = 0, dropped = 0;
+    FileAudioSink sink(opt.pcmPath, 1.0 + opt.audioSkewPpm * 1e-6); AudioOutput<FileAudioSink> output(sink);
+    std::thread video([&] {
+        const auto vsync = std::chrono::microseconds(16667); auto next = std::chrono::steady_clock::now(); uint64_t lastNumber = 0, lastNs = 0;
+        while (!done) {
+            next += vsync; std::this_thread::sleep_until(next); const CoreRunner::Frame* f = runner.AcquireFrame(); uint64_t now = CoreRunner::NowNs();
+            if (!f) { repeated++; continue; }
+            latencyMs.push_back((now - f->publishedNs) / 1e6); if (lastNs) presentIntervalMs.push_back((now - lastNs) / 1e6);
+            if (lastNumber && f->number > lastNumber + 1) dropped += f->number - lastNumber - 1; lastNumber = f->number; lastNs = now; presented++;
+        }
+    });
+    std::thread audio([&] {
+        const int POLL_MS = 2; auto next = std::chrono::steady_clock::now();
+        while (!done) {
+            next += std::chrono::milliseconds(POLL_MS); std::this_thread::sleep_until(next);
+            runner.SetAudioRate(output.Pump(runner.Audio())); if (sink.Queued()) audioQueuedMs.push_back(output.QueuedMs(runner.Audio()));
+        }
+    });
+    runner.Start(); std::this_thread::sleep_for(std::chrono::duration<double>(opt.latencySeconds)); done = true; video.join(); audio.join(); runner.Stop();
+    double lMean, l50, l99, lMax, iMean, i50, i99, iMax, aMean, a50, a99, aMax; Percentiles(latencyMs, lMean, l50, l99, lMax); Percentiles(presentIntervalMs, iMean, i50, i99, iMax); Percentiles(audioQueuedMs, aMean, a50, a99, aMax);
+    double jitter = 0; for (double x : presentIntervalMs) jitter += (x - iMean) * (x - iMean); jitter = presentIntervalMs.empty() ? 0 : sqrt(jitter / presentIntervalMs.size());
+    printf("frames=%llu presented=%llu repeated_vsyncs=%llu dropped=%llu latency_ms mean=%.2f p50=%.2f p99=%.2f max=%.2f present_interval_ms mean=%.2f jitter=%.2f max=%.2f audio_queued_ms mean=%.1f p50=%.1f p99=%.1f max=%.1f audio_underruns=%llu audio_rate=%.5f\n",
+        (unsigned long long)runner.FramesRun(), (unsigned long long)presented, (unsigned long long)repeated, (unsigned long long)dropped, lMean, l50, l99, lMax, iMean, jitter, iMax, aMean, a50, a99, aMax, (unsigned long long)sink.Underruns(), output.Ratio());
+    return 0;
+}
+static int RunMovie(const HeadlessOptions& opt) {
+    std::unique_ptr<GameBoyCore> core(new GameBoyCore()); std::shared_ptr<const RomImage> image; if (!opt.romPath.empty() && !(image = RomImage::Open(opt.romPath))) { fprintf(stderr, "failed to load ROM\n"); return 1; }
+    if (image) core->LoadRomImage(image); auto start = std::chrono::steady_clock::now();
+    if (!opt.recordPath.empty()) {
+        MovieWriter movie; if (!movie.Begin(*core, opt.recordPath)) { fprintf(stderr, "failed to create movie\n"); return 1; } uint32_t seed = 1;
+        for (int f = 0; f < opt.frames; f++) {
+            if (f % 8 == 0) { seed = seed * 1103515245 + 12345; int key = (seed >> 16) & 7; bool pressed = (seed >> 20) & 1; core->InputKey(key, pressed); movie.InputKey(key, pressed); }
+            core->StepFrame(); core->GetAudioSamples().Clear(); movie.EndFrame(*core, true);
+        }
+        movie.Finish(); printf("recorded frames=%d seconds=%.3f\n", opt.frames, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()); return 0;
+    }
+    MoviePlayer movie; if (!movie.Open(opt.replayPath) || !movie.Start(*core)) { fprintf(stderr, "failed to load movie (wrong ROM?)\n"); return 1; }
+    MoviePlayer::Result result; while ((result = movie.StepFrame(*core)) == MoviePlayer::FRAME_MATCH) {}
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (result == MoviePlayer::FRAME_DIVERGED) { printf("diverged at frame %u of %u\n", movie.Frame() - 1, movie.Frames()); return 2; }
+    printf("replayed frames=%u seconds=%.3f fps=%.1f match\n", movie.Frame(), seconds, movie.Frame() / seconds); return 0;
+}
+// Frames captured while the LCD stayed off must come out byte-identical; returns how many did not, or -1 if the file cannot be read back.
+static int CountBlankMismatches(const std::wstring& path, size_t frameBytes, const std::vector<bool>& lcdOff, int& blankFrames) {
+    blankFrames = 0; FILE* fp = OpenFile(path, L"rb"); if (!fp) return -1; int mismatches = 0;
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, L".y4m") == 0) for (int c; (c = fgetc(fp)) != EOF && c != '\n';) {}
+    std::vector<Byte> previous(frameBytes), current(frameBytes);
+    for (size_t f = 0; f < lcdOff.size() && fread(current.data(), 1, frameBytes, fp) == frameBytes; f++) {
+        if (f >= 2 && lcdOff[f] && lcdOff[f - 1] && lcdOff[f - 2]) { blankFrames++; if (current != previous) mismatches++; }
+        previous.swap(current);
+    }
+    fclose(fp); return mismatches;
+}
+static int RunCapture(const HeadlessOptions& opt) {
+    std::unique_ptr<GameBoyCore> core(new GameBoyCore()); if (!opt.romPath.empty() && !core->LoadRom(opt.romPath)) { fprintf(stderr, "failed to load ROM\n"); return 1; }
+    if (opt.romPath.empty() && opt.lcdOffRom) core->LoadRomImage(BuildLcdOffRom());
+    CaptureWriter capture; if (!capture.Open(*core, opt.videoPath, opt.wavPath, opt.captureScale)) { fprintf(stderr, "failed to create capture files\n"); return 1; }
+    std::vector<bool> lcdOff; lcdOff.reserve(opt.frames);
+    auto start = std::chrono::steady_clock::now(); for (int f = 0; f < opt.frames; f++) { core->StepFrame(); lcdOff.push_back(!(core->mmu.io[0x40] & 0x80)); capture.SubmitFrame(*core); }
+    capture.Close(); double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("captured frames=%d scale=%d seconds=%.3f fps=%.1f realtime=%.1fx\n", opt.frames, opt.captureScale, seconds, opt.frames / seconds, opt.frames / seconds / 59.7275);
+    if (opt.videoPath.empty()) return 0; int blankFrames = 0, mismatches = CountBlankMismatches(opt.videoPath, capture.VideoFrameBytes(), lcdOff, blankFrames);
+    printf("blank_frames=%d blank_mismatches=%d\n", blankFrames, mismatches); return mismatches != 0 ? 2 : 0;
+}
+static int RunAheadBenchmark(const HeadlessOptions& opt) {
+    std::shared_ptr<const RomImage> image; if (!opt.romPath.empty() && !(image = RomImage::Open(opt.romPath))) { fprintf(stderr, "failed to load ROM\n"); return 1; }
+    GameBoyCore reference, core; if (image) { reference.LoadRomImage(image); core.LoadRomImage(image); }
+    std::vector<int> keys(opt.frames + opt.runAhead + 1, -1); std::vector<uint64_t> refHash(keys.size()); uint32_t seed = 1;
+    for (size_t f = 0; f < keys.size(); f++) {
+        if (f % 8 == 0) { seed = seed * 1103515245 + 12345; keys[f] = (seed >> 16) & 15; }
+        if (keys[f] >= 0) reference.InputKey(keys[f] & 7, (keys[f] & 8) != 0); reference.StepFrame(); reference.GetAudioSamples().Clear(); refHash[f] = HashBytes(0, reference.displayBuffer.data(), reference.displayBuffer.size() * sizeof(uint32_t));
+    }
+    CoreRunner runner(core); runner.SetRunAhead(opt.runAhead); std::vector<double> frameMs, snapshotUs; int predicted = 0, mispredicted = 0; std::vector<Byte> snapshot;
+    for (int f = 0; f < opt.frames; f++) {
+        if (keys[f] >= 0) runner.InputKey(keys[f] & 7, (keys[f] & 8) != 0);
+        uint64_t t0 = CoreRunner::NowNs(); runner.RunFrames(1); frameMs.push_back((CoreRunner::NowNs() - t0) / 1e6); core.GetAudioSamples().Clear();
+        const CoreRunner::Frame* frame = runner.AcquireFrame(); bool inputChanged = false; for (int k = f + 1; k <= f + opt.runAhead; k++) inputChanged |= keys[k] >= 0;
+        if (frame && !inputChanged) { if (HashBytes(0, frame->pixels.data(), frame->pixels.size() * sizeof(uint32_t)) == refHash[f + opt.runAhead]) predicted++; else mispredicted++; }
+        if (f % 64 == 0) { uint64_t s0 = CoreRunner::NowNs(); core.SaveSnapshot(snapshot); core.RestoreSnapshot(snapshot); snapshotUs.push_back((CoreRunner::NowNs() - s0) / 1e3); }
+    }
+    GameBoyCore check; if (image) check.LoadRomImage(image); for (int f = 0; f < opt.frames; f++) { if (keys[f] >= 0) check.InputKey(keys[f] & 7, (keys[f] & 8) != 0); check.StepFrame(); }
+    std::vector<Byte> a(core.SaveStateSize()), b(check.SaveStateSize()); core.SaveState(a.data(), a.size()); check.SaveState(b.data(), b.size()); size_t stateBytes = a.size() - GB_WIDTH * GB_HEIGHT * sizeof(uint32_t);
+    bool stateMatch = a.size() == b.size() && memcmp(a.data(), b.data(), stateBytes) == 0;
+    double mean, p50, p99, worst, sMean, s50, s99, sMax; Percentiles(frameMs, mean, p50, p99, worst); Percentiles(snapshotUs, sMean, s50, s99, sMax);
+    printf("run_ahead=%d frames=%d frame_ms mean=%.3f p50=%.3f p99=%.3f max=%.3f budget_used=%.1f%% snapshot_bytes=%zu save_restore_us mean=%.1f p99=%.1f predicted=%d mispredicted=%d state=%s\n",
+        opt.runAhead, opt.frames, mean, p50, p99, worst, worst / (CoreRunner::FRAME_SECONDS * 1000) * 100, snapshot.size(), sMean, s99, predicted, mispredicted, stateMatch ? "match" : "DIVERGED");
+    return stateMatch && worst < CoreRunner::FRAME_SECONDS * 1000 ? 0 : 2;
+}
+int main(int argc, char** argv) {
+    setlocale(LC_ALL, ""); HeadlessOptions opt;
+    if (!ParseArgs(argc, argv, opt)) { fprintf(stderr, "usage: %s [-n instances] [-f frames] [-t threads] [-s frames-per-slice] [-l latency-test-seconds [-k audio-skew-ppm] [-w audio.pcm]] [-R record.gbm | -m replay.gbm] [-A run-ahead-frames] [-c video.y4m|video.raw] [-a audio.wav] [-x capture-scale] [-b] [rom.gb]\n", argv[0]); return 1; }
+    if (opt.latencySeconds > 0) return RunLatencyTest(opt);
+    if (!opt.recordPath.empty() || !opt.replayPath.empty()) return RunMovie(opt);
+    if (!opt.videoPath.empty() || !opt.wavPath.empty()) return RunCapture(opt);
+    if (opt.runAhead > 0) return RunAheadBenchmark(opt);
+    std::vector<std::unique_ptr<GameBoyCore>> cores(opt.instances);
+    std::shared_ptr<const RomImage> image; if (!opt.romPath.empty() && !(image = RomImage::Open(opt.romPath))) { fprintf(stderr, "failed to load ROM\n"); return 1; }
+    for (auto& core : cores) { core.reset(new GameBoyCore()); if (image) core->LoadRom(opt.romPath, image); }
+    WorkStealingPool pool(opt.threads); std::vector<int> remaining(opt.instances, opt.frames); std::atomic<long long> framesRun(0);
+    std::function<void(int)> runSlice = [&](int i) {
+        int n = (std::min)(opt.slice, remaining[i]); for (int f = 0; f < n; f++) cores[i]->StepFrame();
+        remaining[i] -= n; framesRun += n; if (remaining[i] > 0) pool.Submit([&runSlice, i] { runSlice(i); });
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.instances; i++) pool.Submit([&runSlice, i] { runSlice(i); });
+    pool.Wait(); double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint32_t checksum = 0; for (auto& core : cores) for (uint32_t px : core->displayBuffer) checksum = checksum * 31 + px;
+    double fps = framesRun / seconds;
+    printf("instances=%d threads=%d frames=%lld seconds=%.3f fps=%.1f per_instance_fps=%.1f realtime=%.1fx checksum=%08x\n",
+        opt.instances, pool.ThreadCount(), (long long)framesRun, seconds, fps, fps / opt.instances, fps / 59.7275, checksum);
+    if (Probe::ENABLED) { fprintf(stderr, "instrumentation for instance 0:\n"); cores[0]->mmu.probe.Report(stderr); }
+    return 0;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+struct MovieHeader { uint32_t magic, version, frames, stateSize; };
+static constexpr uint32_t MOVIE_MAGIC = 0x564D4247, MOVIE_VERSION = 1; static constexpr Byte MOVIE_NO_OUTPUT = 0x01;
+inline uint64_t FrameHash(const GameBoyCore& core) {
+    uint64_t h = HashBytes(core.apu.sampleHash, core.displayBuffer.data(), core.displayBuffer.size() * sizeof(uint32_t));
+    h = HashBytes(h, core.mmu.wram.data(), core.mmu.wram.size()); return HashBytes(h, core.mmu.hram.data(), core.mmu.hram.size());
+}
+class MovieWriter {
+    FILE* m_fp; MovieHeader m_header; std::vector<Byte> m_keys;
+public:
+    MovieWriter() : m_fp(NULL), m_header() {}
+    ~MovieWriter() { Finish(); }
+    MovieWriter(const MovieWriter&) = delete; MovieWriter& operator=(const MovieWriter&) = delete;
+    bool Recording() const { return m_fp != NULL; } uint32_t Frames() const { return m_header.frames; }
+    bool Begin(GameBoyCore& core, const std::wstring& path) {
+        Finish(); core.SetEmulatedClock(true); core.apu.ResetOutput(); std::vector<Byte> state(core.SaveStateSize());
+        if (!core.SaveState(state.data(), state.size()) || !(m_fp = OpenFile(path, L"wb"))) return false;
+        m_header = { MOVIE_MAGIC, MOVIE_VERSION, 0, (uint32_t)state.size() }; m_keys.clear();
+        fwrite(&m_header, sizeof(m_header), 1, m_fp); fwrite(state.data(), 1, state.size(), m_fp); return true;
+    }
+    void InputKey(int key, bool pressed) { if (m_fp) m_keys.push_back((Byte)(key | (pressed ? 0x80 : 0))); }
+    void EndFrame(const GameBoyCore& core, bool produceOutput) {
+        if (!m_fp) return; Byte flags = produceOutput ? 0 : MOVIE_NO_OUTPUT; Word count = (Word)m_keys.size(); uint64_t hash = FrameHash(core);
+        fwrite(&flags, 1, 1, m_fp); fwrite(&count, sizeof(count), 1, m_fp); fwrite(m_keys.data(), 1, count, m_fp); fwrite(&hash, sizeof(hash), 1, m_fp); m_keys.clear(); m_header.frames++;
+    }
+    void Finish() { if (!m_fp) return; fseek(m_fp, 0, SEEK_SET); fwrite(&m_header, sizeof(m_header), 1, m_fp); fclose(m_fp); m_fp = NULL; }
+};
+class MoviePlayer {
+    std::vector<Byte> m_data; MovieHeader m_header; size_t m_pos; uint32_t m_frame;
+public:
+    enum Result { FRAME_MATCH, FRAME_DIVERGED, MOVIE_END };
+    MoviePlayer() : m_header(), m_pos(0), m_frame(0) {}
+    uint32_t Frames() const { return m_header.frames; } uint32_t Frame() const { return m_frame; }
+    bool Open(const std::wstring& path) {
+        FILE* fp = OpenFile(path, L"rb"); if (!fp) return false;
+        fseek(fp, 0, SEEK_END); long size = ftell(fp); fseek(fp, 0, SEEK_SET); m_data.assign(size > 0 ? size : 0, 0);
+        bool ok = size >= (long)sizeof(MovieHeader) && fread(m_data.data(), 1, size, fp) == (size_t)size; fclose(fp); if (!ok) return false;
+        memcpy(&m_header, m_data.data(), sizeof(m_header)); return m_header.magic == MOVIE_MAGIC && m_header.version == MOVIE_VERSION && sizeof(MovieHeader) + m_header.stateSize <= m_data.size();
+    }
+    bool Start(GameBoyCore& core) {
+        if (!core.LoadState(m_data.data() + sizeof(MovieHeader), m_header.stateSize)) return false;
+        core.SetEmulatedClock(true); core.apu.ResetOutput(); core.GetAudioSamples().Clear(); m_pos = sizeof(MovieHeader) + m_header.stateSize; m_frame = 0; return true;
+    }
+    Result StepFrame(GameBoyCore& core) {
+        Word count; if (m_frame >= m_header.frames || m_pos + 3 > m_data.size()) return MOVIE_END; memcpy(&count, &m_data[m_pos + 1], sizeof(count));
+        if (m_pos + 3 + count + sizeof(uint64_t) > m_data.size()) return MOVIE_END; Byte flags = m_data[m_pos]; const Byte* keys = &m_data[m_pos + 3]; uint64_t expected;
+        for (int i = 0; i < count; i++) core.InputKey(keys[i] & 0x7F, (keys[i] & 0x80) != 0);
+        memcpy(&expected, keys + count, sizeof(expected)); m_pos += 3 + count + sizeof(expected); m_frame++;
+        core.StepFrame(!(flags & MOVIE_NO_OUTPUT)); core.GetAudioSamples().Clear(); return FrameHash(core) == expected ? FRAME_MATCH : FRAME_DIVERGED;
+    }
+};
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include "GameBoyCore.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+class RewindBuffer {
+    struct Entry { bool keyframe; std::vector<Byte> data; };
+    std::deque<Entry> m_entries; std::deque<std::vector<Byte>> m_pending; std::vector<std::vector<Byte>> m_free; std::vector<Byte> m_current, m_scratch;
+    size_t m_budget, m_bytes; int m_keyframeInterval, m_sinceKeyframe; bool m_stop, m_busy;
+    std::mutex m_lock; std::condition_variable m_workCv, m_idleCv; std::thread m_thread;
+    static void PutVarint(std::vector<Byte>& out, size_t v) { while (v >= 0x80) { out.push_back((Byte)(v | 0x80)); v >>= 7; } out.push_back((Byte)v); }
+    static size_t GetVarint(const Byte*& p) { size_t v = 0; int shift = 0; Byte b; do { b = *p++; v |= (size_t)(b & 0x7F) << shift; shift += 7; } while (b & 0x80); return v; }
+    static void Encode(const std::vector<Byte>& cur, const std::vector<Byte>* base, std::vector<Byte>& out) {
+        out.clear(); size_t n = cur.size(), i = 0; auto diff = [&](size_t k) { return (Byte)(base ? cur[k] ^ (*base)[k] : cur[k]); };
+        while (i < n) {
+            size_t zeroStart = i; while (i < n && diff(i) == 0) i++; size_t litStart = i, zeros = 0;
+            while (i < n && zeros < 4) { zeros = diff(i) ? 0 : zeros + 1; i++; } if (zeros) i -= zeros;
+            PutVarint(out, litStart - zeroStart); PutVarint(out, i - litStart); for (size_t k = litStart; k < i; k++) out.push_back(diff(k));
+        }
+    }
+    static void ApplyXor(const std::vector<Byte>& in, std::vector<Byte>& state) {
+        const Byte* p = in.data(); const Byte* end = p + in.size(); size_t pos = 0;
+        while (p < end) { pos += GetVarint(p); size_t lit = GetVarint(p); for (size_t k = 0; k < lit; k++) state[pos++] ^= *p++; }
+    }
+    void WorkerLoop() {
+        std::unique_lock<std::mutex> guard(m_lock);
+        while (true) {
+            m_workCv.wait(guard, [&] { return m_stop || !m_pending.empty(); }); if (m_pending.empty()) break;
+            std::vector<Byte> raw = std::move(m_pending.front()); m_pending.pop_front(); m_busy = true;
+            bool keyframe = m_current.size() != raw.size() || m_entries.empty() || m_sinceKeyframe >= m_keyframeInterval;
+            guard.unlock(); Entry entry = { keyframe, {} }; Encode(raw, keyframe ? nullptr : &m_current, m_scratch); entry.data.assign(m_scratch.begin(), m_scratch.end()); m_current.swap(raw); guard.lock();
+            m_bytes += entry.data.size(); m_entries.push_back(std::move(entry)); m_sinceKeyframe = keyframe ? 1 : m_sinceKeyframe + 1; m_free.push_back(std::move(raw));
+            while (m_bytes > m_budget && m_entries.size() > 1) {
+                size_t next = 1; while (next < m_entries.size() && !m_entries[next].keyframe) next++; if (next == m_entries.size()) break;
+                for (size_t k = 0; k < next; k++) { m_bytes -= m_entries.front().data.size(); m_entries.pop_front(); }
+            }
+            m_busy = false; if (m_pending.empty()) m_idleCv.notify_all();
+        }
+    }
+    void Flush(std::unique_lock<std::mutex>& guard) { m_idleCv.wait(guard, [&] { return m_pending.empty() && !m_busy; }); }
+public:
+    explicit RewindBuffer(size_t budgetBytes = 64 << 20, int keyframeInterval = 60) : m_budget(budgetBytes), m_bytes(0), m_keyframeInterval(keyframeInterval), m_sinceKeyframe(0), m_stop(false), m_busy(false) { m_thread = std::thread(&RewindBuffer::WorkerLoop, this); }
+    ~RewindBuffer() { { std::lock_guard<std::mutex> guard(m_lock); m_stop = true; } m_workCv.notify_all(); m_thread.join(); }
+    void SetBudget(size_t budgetBytes) { std::lock_guard<std::mutex> guard(m_lock); m_budget = budgetBytes; }
+    void Clear() { std::unique_lock<std::mutex> guard(m_lock); Flush(guard); m_entries.clear(); m_current.clear(); m_bytes = 0; m_sinceKeyframe = 0; }
+    size_t Frames() { std::lock_guard<std::mutex> guard(m_lock); return m_entries.size() + m_pending.size(); }
+    size_t BytesUsed() { std::lock_guard<std::mutex> guard(m_lock); return m_bytes; }
+    void Push(GameBoyCore& core) {
+        std::vector<Byte> raw; { std::lock_guard<std::mutex> guard(m_lock); if (!m_free.empty()) { raw = std::move(m_free.back()); m_free.pop_back(); } }
+        raw.resize(core.SaveStateSize()); if (!core.SaveState(raw.data(), raw.size())) return;
+        { std::lock_guard<std::mutex> guard(m_lock); m_pending.push_back(std::move(raw)); } m_workCv.notify_one();
+    }
+    bool Rewind(GameBoyCore& core) {
+        std::unique_lock<std::mutex> guard(m_lock); Flush(guard); if (m_entries.size() < 2) return false;
+        Entry last = std::move(m_entries.back()); m_entries.pop_back(); m_bytes -= last.data.size();
+        if (!last.keyframe) ApplyXor(last.data, m_current);
+        else {
+            size_t key = m_entries.size() - 1; while (!m_entries[key].keyframe) key--;
+            std::fill(m_current.begin(), m_current.end(), 0); for (size_t k = key; k < m_entries.size(); k++) ApplyXor(m_entries[k].data, m_current);
+        }
+        m_sinceKeyframe = 0; for (size_t k = m_entries.size(); k-- > 0 && !m_entries[k].keyframe;) m_sinceKeyframe++; m_sinceKeyframe++;
+        return core.LoadState(m_current.data(), m_current.size());
+    }
+};
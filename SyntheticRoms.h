@@ -0,0 +1,94 @@
+﻿#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <cstdint>
+class RomBuilder {
+    std::vector<uint8_t> m_rom; size_t m_pc; std::map<std::string, uint16_t> m_labels; struct Fixup { size_t at; std::string label; bool relative; }; std::vector<Fixup> m_fixups;
+public:
+    RomBuilder(int banks, uint8_t cartType) : m_rom(banks * 0x4000, 0), m_pc(0) {
+        m_rom[0x0147] = cartType; int code = 0; while ((0x8000 << code) < banks * 0x4000) code++; m_rom[0x0148] = (uint8_t)code; m_rom[0x0149] = 0x02;
+        const char* title = "SYNTHETIC"; for (int i = 0; title[i]; i++) m_rom[0x0134 + i] = title[i];
+        Org(0x100); Emit({ 0x00, 0xC3 }); Word16Label("main");
+    }
+    std::vector<uint8_t>& Data() { return m_rom; }
+    void Org(size_t addr) { m_pc = addr; }
+    void Label(const std::string& name) { m_labels[name] = (uint16_t)(m_pc < 0x4000 ? m_pc : 0x4000 + (m_pc & 0x3FFF)); }
+    void Emit(std::initializer_list<int> bytes) { for (int b : bytes) m_rom[m_pc++] = (uint8_t)b; }
+    void Word16Label(const std::string& label) { m_fixups.push_back({ m_pc, label, false }); m_pc += 2; }
+    void Jr(int op, const std::string& label) { Emit({ op }); m_fixups.push_back({ m_pc, label, true }); m_pc++; }
+    void Jp(int op, const std::string& label) { Emit({ op }); Word16Label(label); }
+    void Finish() {
+        for (auto& f : m_fixups) {
+            uint16_t target = m_labels.at(f.label);
+            if (f.relative) { int here = (int)(f.at < 0x4000 ? f.at : 0x4000 + (f.at & 0x3FFF)) + 1; m_rom[f.at] = (uint8_t)(int8_t)(target - here); }
+            else { m_rom[f.at] = target & 0xFF; m_rom[f.at + 1] = target >> 8; }
+        }
+    }
+};
+// Shared setup: loads a tile set from bank 1, fills the maps and copies a DMA routine to HRAM.
+inline void EmitVideoSetup(RomBuilder& b, uint8_t lcdc) {
+    b.Label("waitvb"); b.Emit({ 0xF0, 0x44, 0xFE, 0x90 }); b.Jr(0x20, "waitvb");
+    b.Emit({ 0xAF, 0xE0, 0x40 });
+    b.Emit({ 0x3E, 0x01, 0xEA, 0x00, 0x20 });
+    b.Emit({ 0x21, 0x00, 0x40, 0x11, 0x00, 0x80, 0x01, 0x00, 0x18 });
+    b.Label("copytiles"); b.Emit({ 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1 }); b.Jr(0x20, "copytiles");
+    b.Emit({ 0x21, 0x00, 0x98, 0x01, 0x00, 0x08, 0x1E, 0x00 });
+    b.Label("fillmap"); b.Emit({ 0x7B, 0x22, 0x1C, 0x0B, 0x78, 0xB1 }); b.Jr(0x20, "fillmap");
+    b.Emit({ 0x21, 0x00, 0xC0, 0x0E, 0x00 });
+    b.Label("fillobj"); b.Emit({ 0x79, 0x87, 0x81, 0xC6, 0x10, 0x22, 0x79, 0x87, 0x87, 0xC6, 0x08, 0x22, 0x79, 0x22, 0x79, 0xCB, 0x37, 0xE6, 0xF0, 0x22, 0x0C, 0x79, 0xFE, 0x28 }); b.Jr(0x20, "fillobj");
+    b.Emit({ 0x21, 0x80, 0xFF, 0x3E, 0x3E, 0x22, 0x3E, 0xC0, 0x22, 0x3E, 0xE0, 0x22, 0x3E, 0x46, 0x22, 0x3E, 0x3E, 0x22, 0x3E, 0x28, 0x22, 0x3E, 0x3D, 0x22, 0x3E, 0x20, 0x22, 0x3E, 0xFD, 0x22, 0x3E, 0xC9, 0x22 });
+    b.Emit({ 0xCD, 0x80, 0xFF });
+    b.Emit({ 0x3E, 0xE4, 0xE0, 0x47, 0x3E, 0xD2, 0xE0, 0x48, 0x3E, 0x1B, 0xE0, 0x49, 0x3E, 0x3C, 0xE0, 0x4A, 0x3E, 0x57, 0xE0, 0x4B });
+    b.Emit({ 0x3E, lcdc, 0xE0, 0x40 });
+}
+inline void EmitTileBank(RomBuilder& b) { auto& d = b.Data(); for (int i = 0; i < 0x1800; i++) d[0x4000 + i] = (uint8_t)((i * 37) ^ (i >> 3) ^ (i >> 7)); for (int i = 0; i < 0x4000; i++) { d[0x8000 + i] = (uint8_t)(i * 13 + 7); if (d.size() > 0xC000) d[0xC000 + i] = (uint8_t)(i ^ 0x5A); } }
+// CPU-bound: ALU, CB, stack and banked ROM reads in a tight loop, LCD on with background only.
+inline std::vector<uint8_t> BuildCpuStressRom() {
+    RomBuilder b(4, 0x01); b.Org(0x150); b.Label("main"); b.Emit({ 0xF3, 0x31, 0xFE, 0xFF }); EmitVideoSetup(b, 0x91);
+    b.Label("loop");
+    b.Emit({ 0x3E, 0x02, 0xEA, 0x00, 0x20, 0x21, 0x00, 0x40, 0x06, 0x40 });
+    b.Label("inner"); b.Emit({ 0x2A, 0x4F, 0x81, 0xCB, 0x37, 0xCB, 0x11, 0xCB, 0x78, 0x27, 0x88, 0x57, 0xAB, 0x5F, 0xC5, 0xD5, 0xD1, 0xC1, 0xCD }); b.Word16Label("sub"); b.Emit({ 0x05 }); b.Jr(0x20, "inner");
+    b.Emit({ 0x3E, 0x03, 0xEA, 0x00, 0x20, 0xFA, 0x34, 0x52, 0xEA, 0x00, 0xC1, 0x21, 0x00, 0xC2, 0x34, 0x35, 0x34 }); b.Jp(0xC3, "loop");
+    b.Label("sub"); b.Emit({ 0xE5, 0x09, 0x29, 0xE1, 0x23, 0x2B, 0xCB, 0x1A, 0xCB, 0x2B, 0xCB, 0x3B, 0xC9 });
+    EmitTileBank(b); b.Finish(); return b.Data();
+}
+// PPU-bound: window, 8x16 sprites, per-frame scroll and OAM DMA from the vblank handler, HALT in the main loop.
+inline std::vector<uint8_t> BuildPpuStressRom() {
+    RomBuilder b(4, 0x01);
+    b.Org(0x40); b.Jp(0xC3, "vblank");
+    b.Org(0x48); b.Jp(0xC3, "stat");
+    b.Org(0x150); b.Label("main"); b.Emit({ 0xF3, 0x31, 0xFE, 0xFF }); EmitVideoSetup(b, 0xF7);
+    b.Emit({ 0x3E, 0x40, 0xE0, 0x41, 0x3E, 0x48, 0xE0, 0x45, 0x3E, 0x03, 0xE0, 0xFF, 0xFB });
+    b.Label("idle"); b.Emit({ 0x76, 0x00 }); b.Jr(0x18, "idle");
+    b.Label("vblank"); b.Emit({ 0xF5, 0xE5, 0xF0, 0x43, 0x3C, 0xE0, 0x43, 0xF0, 0x42, 0x3D, 0xE0, 0x42, 0x21, 0x00, 0xC0, 0x06, 0x28 });
+    b.Label("mvobj"); b.Emit({ 0x34, 0x23, 0x35, 0x23, 0x23, 0x23, 0x05 }); b.Jr(0x20, "mvobj");
+    b.Emit({ 0xCD, 0x80, 0xFF, 0xF0, 0x4B, 0x3D, 0xE0, 0x4B, 0xE1, 0xF1, 0xD9 });
+    b.Label("stat"); b.Emit({ 0xF5, 0xF0, 0x47, 0x2F, 0xE0, 0x47, 0xF0, 0x45, 0xC6, 0x10, 0xFE, 0x90 }); b.Jr(0x38, "statok"); b.Emit({ 0x3E, 0x08 }); b.Label("statok"); b.Emit({ 0xE0, 0x45, 0xF1, 0xD9 });
+    EmitTileBank(b); b.Finish(); return b.Data();
+}
+// APU-bound: all four channels retriggered with sweeps, envelopes and noise from a timer interrupt.
+inline std::vector<uint8_t> BuildApuStressRom() {
+    RomBuilder b(2, 0x00);
+    b.Org(0x50); b.Jp(0xC3, "timer");
+    b.Org(0x150); b.Label("main"); b.Emit({ 0xF3, 0x31, 0xFE, 0xFF, 0x3E, 0x91, 0xE0, 0x40 });
+    b.Emit({ 0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25 });
+    b.Emit({ 0x21, 0x30, 0xFF, 0x06, 0x10, 0x3E, 0x19 }); b.Label("wave"); b.Emit({ 0x22, 0xC6, 0x23, 0x05 }); b.Jr(0x20, "wave");
+    b.Emit({ 0x3E, 0x00, 0xE0, 0x06, 0x3E, 0x06, 0xE0, 0x07, 0x3E, 0x04, 0xE0, 0xFF, 0x0E, 0x00, 0xFB });
+    b.Label("idle"); b.Emit({ 0x76, 0x00 }); b.Jr(0x18, "idle");
+    b.Label("timer"); b.Emit({ 0xF5, 0x0C, 0x79, 0xE6, 0x07 }); b.Jr(0x20, "tend");
+    b.Emit({ 0x3E, 0x16, 0xE0, 0x10, 0x3E, 0x81, 0xE0, 0x11, 0x3E, 0xF3, 0xE0, 0x12, 0x79, 0xE0, 0x13, 0x3E, 0x86, 0xE0, 0x14 });
+    b.Emit({ 0x3E, 0x42, 0xE0, 0x16, 0x3E, 0xA5, 0xE0, 0x17, 0x79, 0x2F, 0xE0, 0x18, 0x3E, 0xC5, 0xE0, 0x19 });
+    b.Emit({ 0x3E, 0x80, 0xE0, 0x1A, 0x3E, 0x20, 0xE0, 0x1C, 0x79, 0x07, 0xE0, 0x1D, 0x3E, 0x85, 0xE0, 0x1E });
+    b.Emit({ 0x3E, 0xF2, 0xE0, 0x21, 0x79, 0xE6, 0x77, 0xE0, 0x22, 0x3E, 0x80, 0xE0, 0x23 }); b.Label("tend"); b.Emit({ 0xF1, 0xD9 });
+    b.Finish(); return b.Data();
+}
+// LCD-off: scrolls the background with sprites for 90 frames, then switches the LCD off and spins so captures see a long blank stretch.
+inline std::vector<uint8_t> BuildLcdOffRom() {
+    RomBuilder b(4, 0x01); b.Org(0x150); b.Label("main"); b.Emit({ 0xF3, 0x31, 0xFE, 0xFF }); EmitVideoSetup(b, 0x93); b.Emit({ 0x0E, 0x5A });
+    b.Label("scroll"); b.Emit({ 0xF0, 0x44, 0xFE, 0x90 }); b.Jr(0x20, "scroll"); b.Emit({ 0xF0, 0x43, 0x3C, 0xE0, 0x43 });
+    b.Label("leave"); b.Emit({ 0xF0, 0x44, 0xFE, 0x90 }); b.Jr(0x28, "leave"); b.Emit({ 0x0D }); b.Jr(0x20, "scroll");
+    b.Label("lastvb"); b.Emit({ 0xF0, 0x44, 0xFE, 0x90 }); b.Jr(0x20, "lastvb"); b.Emit({ 0xAF, 0xE0, 0x40 });
+    b.Label("spin"); b.Emit({ 0x00 }); b.Jr(0x18, "spin");
+    EmitTileBank(b); b.Finish(); return b.Data();
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+private:
+    struct Worker { std::mutex lock; std::deque<Task> tasks; };
+    std::vector<std::unique_ptr<Worker>> m_workers; std::vector<std::thread> m_threads;
+    std::mutex m_idleLock; std::condition_variable m_idleCv, m_doneCv; std::atomic<int> m_pending, m_queued; std::atomic<bool> m_stop; std::atomic<unsigned> m_nextQueue;
+    struct Current { const WorkStealingPool* pool; int index; };
+    static Current& CurrentWorker() { static thread_local Current current = { nullptr, -1 }; return current; }
+    bool PopLocal(int self, Task& task) { Worker& w = *m_workers[self]; std::lock_guard<std::mutex> guard(w.lock); if (w.tasks.empty()) return false; task = std::move(w.tasks.back()); w.tasks.pop_back(); --m_queued; return true; }
+    bool Steal(int self, Task& task) {
+        int n = (int)m_workers.size();
+        for (int i = 1; i < n; i++) { Worker& w = *m_workers[(self + i) % n]; std::lock_guard<std::mutex> guard(w.lock); if (!w.tasks.empty()) { task = std::move(w.tasks.front()); w.tasks.pop_front(); --m_queued; return true; } }
+        return false;
+    }
+    void WorkerLoop(int self) {
+        CurrentWorker() = { this, self }; Task task;
+        while (!m_stop) {
+            if (PopLocal(self, task) || Steal(self, task)) { task(); task = nullptr; if (--m_pending == 0) { std::lock_guard<std::mutex> guard(m_idleLock); m_doneCv.notify_all(); } continue; }
+            std::unique_lock<std::mutex> guard(m_idleLock); m_idleCv.wait(guard, [&] { return m_stop || m_queued > 0; });
+        }
+    }
+public:
+    explicit WorkStealingPool(int threads = 0) : m_pending(0), m_queued(0), m_stop(false), m_nextQueue(0) {
+        if (threads <= 0) threads = (std::max)(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < threads; i++) m_workers.emplace_back(new Worker());
+        for (int i = 0; i < threads; i++) m_threads.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+    }
+    ~WorkStealingPool() { { std::lock_guard<std::mutex> guard(m_idleLock); m_stop = true; } m_idleCv.notify_all(); for (auto& t : m_threads) t.join(); }
+    int ThreadCount() const { return (int)m_workers.size(); }
+    void Submit(Task task) {
+        int self = (CurrentWorker().pool == this) ? CurrentWorker().index : -1; int target = (self >= 0) ? self : (int)(m_nextQueue++ % m_workers.size());
+        ++m_pending; { std::lock_guard<std::mutex> guard(m_workers[target]->lock); m_workers[target]->tasks.push_back(std::move(task)); ++m_queued; }
+        std::lock_guard<std::mutex> guard(m_idleLock); m_idleCv.notify_one();
+    }
+    void Wait() { std::unique_lock<std::mutex> guard(m_idleLock); m_doneCv.wait(guard, [&] { return m_pending == 0; }); }
+};